@@ -8,77 +8,268 @@
 #include <errno.h>
 #include <time.h>
 #include <assert.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 // UTIL
 
 #define nukeif(x) if (__builtin_expect(x, 0)) __builtin_trap()
 
-#define CHUNK16 256
-#define CHUNK24 256
-#define CHUNK32 128
-#define CHUNK64  64
-#define CHUNK128 32
-
-#define new_pool(x)\
-	typedef struct p##x {char p[x];} p##x;				    \
-	p##x pool##x [CHUNK##x ];					    \
-	unsigned short table##x[CHUNK##x ];				    \
-	unsigned short lookup##x;					    \
-	__attribute__((constructor, cold)) static void init_pool##x (void) {\
-		for (unsigned short i = 0; i < CHUNK##x; i++)		    \
-			table##x [i] = i+1;				    \
-		lookup##x = 0;						    \
-	}								    \
-	static void* borrow_pool##x (void) {				    \
-		if (lookup##x != CHUNK##x ) {				    \
-			void* res = pool##x [lookup##x ].p;		    \
-			lookup##x = table##x [lookup##x ];		    \
-			return res;					    \
-		}							    \
-		return NULL;						    \
-	}								    \
-	static bool return_pool##x (void* p) {				    \
-		int i = ((intptr_t)p - (intptr_t)pool##x ) / sizeof(p##x ); \
-		if (i < 0 || i >= CHUNK##x ) return false;		    \
-		table##x [i] = lookup##x ;				    \
-		lookup##x = i;						    \
-		return true;						    \
-	} struct _
-
-new_pool(16);  // vars, small char arrays
-new_pool(24);  // array, string objects
-new_pool(32);  // char arrays
-new_pool(64);  // char arrays
-new_pool(128); // var, char arrays
+// small objects come from slabs: SLAB_SIZE aligned blocks that each serve
+// one size class, taken from the system whenever a class runs dry. A two
+// level radix map from slab number to class says in O(1) whether a pointer
+// is ours and which free list it goes back to. Classes and slab size can be
+// set at build time
+
+#ifndef SLAB_SHIFT
+#define SLAB_SHIFT 16
+#endif
+#ifndef SLAB_CLASSES
+#define SLAB_CLASSES 16, 24, 32, 64, 128
+#endif
+
+#define SLAB_SIZE ((size_t)1 << SLAB_SHIFT)
+#define SLAB_LEAF_BITS 16
+#define SLAB_ROOT_BITS (48 - SLAB_SHIFT - SLAB_LEAF_BITS)
+
+static const size_t slab_sizes[] = {SLAB_CLASSES};
+
+#define SLAB_NCLASS (sizeof(slab_sizes)/sizeof(size_t))
+
+typedef struct slot_free {
+	struct slot_free* n;
+} slot_free;
+
+static struct {
+	slot_free* free;
+	char* bump;
+	char* end;
+} slabs[SLAB_NCLASS];
+
+// slabs the region below bump allocates from are mapped to this class
+#define SLAB_REGION 0xff
+
+static unsigned char* slab_map[(size_t)1 << SLAB_ROOT_BITS];
+
+#ifdef ALLOC_PROFILE
+
+// counts per size class (one more for what goes to malloc) and per token
+// being run when the allocation happened, printed to stderr at exit.
+// malloc'd blocks get a header with their size so their frees count too
+// (build with -DALLOC_PROFILE added to the gcc line of b or d)
+
+#define prof(x) x
+#define PROF_HEAD 16
+
+typedef struct {
+	size_t allocs;
+	size_t reused;
+	size_t slabs;
+	size_t frees;
+	size_t bytes;
+	size_t live;
+	size_t peak;
+} prof_class;
+
+typedef struct {
+	const char* k;
+	char* name;
+	size_t allocs;
+	size_t fallbacks;
+	size_t bytes;
+} prof_site;
+
+static prof_class prof_classes[SLAB_NCLASS + 1];
+static size_t prof_region = 0;
+static size_t prof_region_bytes = 0;
+static size_t prof_live = 0;
+static size_t prof_peak = 0;
+static prof_site* prof_sites = NULL;
+static size_t prof_nsites = 0;
+static size_t prof_at = 0;
+static size_t* prof_stack = NULL;
+static size_t prof_depth = 0;
+static size_t prof_cap = 0;
+
+static void prof_alloc(size_t c, size_t n) {
+	prof_classes[c].allocs++;
+	prof_classes[c].bytes += n;
+	prof_classes[c].live += n;
+	if (prof_classes[c].live > prof_classes[c].peak) prof_classes[c].peak = prof_classes[c].live;
+	prof_live += n;
+	if (prof_live > prof_peak) prof_peak = prof_live;
+	if (prof_sites == NULL) return;
+	prof_sites[prof_at].allocs++;
+	prof_sites[prof_at].bytes += n;
+	if (c == SLAB_NCLASS) prof_sites[prof_at].fallbacks++;
+}
+
+static void prof_free(size_t c, size_t n) {
+	prof_classes[c].frees++;
+	prof_classes[c].live -= n;
+	prof_live -= n;
+}
+
+static size_t prof_find(const char* k, size_t len) {
+	for (size_t i = prof_nsites; i-- > 0;)
+		if (prof_sites[i].k == k) return i;
+	if ((prof_nsites & (prof_nsites - 1)) == 0) {
+		prof_sites = realloc(prof_sites, sizeof(prof_site)*(prof_nsites ? prof_nsites*2 : 1));
+		nukeif(!prof_sites);
+	}
+	char* name = malloc(len + 1);
+	nukeif(!name);
+	memcpy(name, k, len);
+	name[len] = '\0';
+	prof_sites[prof_nsites] = (prof_site) {.k = k, .name = name};
+	return prof_nsites++;
+}
+
+static void prof_push(const char* k, size_t len) {
+	if (prof_depth == prof_cap) {
+		prof_cap = prof_cap ? prof_cap*2 : 64;
+		prof_stack = realloc(prof_stack, sizeof(size_t)*prof_cap);
+		nukeif(!prof_stack);
+	}
+	prof_stack[prof_depth++] = prof_at;
+	prof_at = prof_find(k, len);
+}
+
+static void prof_pop(void) {
+	prof_at = prof_stack[--prof_depth];
+}
+
+static int prof_cmp(const void* a, const void* b) {
+	size_t x = ((const prof_site*)a)->bytes;
+	size_t y = ((const prof_site*)b)->bytes;
+	return (x < y) - (x > y);
+}
+
+__attribute__((cold))
+static void prof_report(void) {
+	fprintf(stderr, "%-8s %10s %10s %8s %10s %12s %12s\n",
+		"class", "allocs", "reused", "slabs", "frees", "bytes", "peak");
+	for (size_t c = 0; c <= SLAB_NCLASS; c++) {
+		prof_class* x = &prof_classes[c];
+		char name[16];
+		if (c < SLAB_NCLASS) snprintf(name, sizeof(name), "%zu", slab_sizes[c]);
+		else snprintf(name, sizeof(name), "malloc");
+		fprintf(stderr, "%-8s %10zu %10zu %8zu %10zu %12zu %12zu\n",
+			name, x->allocs, x->reused, x->slabs, x->frees, x->bytes, x->peak);
+	}
+	fprintf(stderr, "%-8s %10zu %10s %8s %10s %12zu\n", "region",
+		prof_region, "", "", "", prof_region_bytes);
+	fprintf(stderr, "peak live %zu bytes\n\n", prof_peak);
+	fprintf(stderr, "%-24s %10s %10s %12s\n", "site", "allocs", "malloc", "bytes");
+	qsort(prof_sites, prof_nsites, sizeof(prof_site), prof_cmp);
+	for (size_t i = 0; i < prof_nsites; i++) {
+		prof_site* x = &prof_sites[i];
+		fprintf(stderr, "%-24.24s %10zu %10zu %12zu\n", x->name, x->allocs, x->fallbacks, x->bytes);
+		free(x->name);
+	}
+	free(prof_sites);
+	free(prof_stack);
+}
+
+__attribute__((constructor, cold))
+static void prof_init(void) {
+	prof_find("(top)", 5);
+	atexit(prof_report);
+}
+
+#else
+
+#define prof(x)
+#define prof_push(k, len)
+#define prof_pop()
+#define PROF_HEAD 0
+
+#endif
+
+// class + 1 of the slab p is in, 0 if it is not from a slab
+static unsigned slab_class(const void* p) {
+	uintptr_t n = (uintptr_t)p >> SLAB_SHIFT;
+	if (n >> (SLAB_ROOT_BITS + SLAB_LEAF_BITS)) return 0;
+	unsigned char* leaf = slab_map[n >> SLAB_LEAF_BITS];
+	if (leaf == NULL) return 0;
+	return leaf[n & (((uintptr_t)1 << SLAB_LEAF_BITS) - 1)];
+}
+
+static bool slab_map_set(void* p, unsigned c) {
+	uintptr_t n = (uintptr_t)p >> SLAB_SHIFT;
+	if (n >> (SLAB_ROOT_BITS + SLAB_LEAF_BITS)) return false;
+	unsigned char** leaf = &slab_map[n >> SLAB_LEAF_BITS];
+	if (*leaf == NULL) {
+		*leaf = calloc((size_t)1 << SLAB_LEAF_BITS, 1);
+		if (*leaf == NULL) return false;
+	}
+	(*leaf)[n & (((uintptr_t)1 << SLAB_LEAF_BITS) - 1)] = c;
+	return true;
+}
+
+__attribute__((cold))
+static bool slab_grow(size_t c) {
+	char* p = aligned_alloc(SLAB_SIZE, SLAB_SIZE);
+	if (p == NULL) return false;
+	if (!slab_map_set(p, c + 1)) {
+		free(p);
+		return false;
+	}
+	prof(prof_classes[c].slabs++);
+	slabs[c].bump = p;
+	slabs[c].end = p + (SLAB_SIZE/slab_sizes[c])*slab_sizes[c];
+	return true;
+}
+
+static void* slab_take(size_t c) {
+	slot_free* res = slabs[c].free;
+	if (res) {
+		prof(prof_classes[c].reused++);
+		slabs[c].free = res->n;
+		return res;
+	}
+	if (slabs[c].bump == slabs[c].end && !slab_grow(c)) return NULL;
+	void* p = slabs[c].bump;
+	slabs[c].bump += slab_sizes[c];
+	return p;
+}
 
 static void checked_free(void* p) {
 	nukeif(!p);
-	if (return_pool16(p)) return;
-	if (return_pool24(p)) return;
-	if (return_pool32(p)) return;
-	if (return_pool64(p)) return;
-	if (return_pool128(p)) return;
-	free(p);
+	unsigned c = slab_class(p);
+	if (c == SLAB_REGION) return;
+	if (c == 0) {
+		p = (char*)p - PROF_HEAD;
+		prof(prof_free(SLAB_NCLASS, *(size_t*)p));
+		free(p);
+		return;
+	}
+	prof(prof_free(c-1, slab_sizes[c-1]));
+	slot_free* s = p;
+	s->n = slabs[c-1].free;
+	slabs[c-1].free = s;
 }
 
 static void* checked_malloc(size_t n) {
 	nukeif(!n);
-	
-#define try_borrow(x, y)		\
-	if (n > x && n <= y) {		\
-		res = borrow_pool##y ();\
-		if (res) return res;	\
-	} struct _
-	
 	void* res = NULL;
-	try_borrow(0, 16);
-	try_borrow(16, 24);
-	try_borrow(24, 32);
-	try_borrow(32, 64);
-	try_borrow(64, 128);
-	res = malloc(n);
+	for (size_t c = 0; c < SLAB_NCLASS; c++) {
+		if (n > slab_sizes[c]) continue;
+		res = slab_take(c);
+		if (res) {
+			prof(prof_alloc(c, slab_sizes[c]));
+			return res;
+		}
+		break;
+	}
+	res = malloc(n + PROF_HEAD);
 	nukeif(!res);
-	return res;
+	prof(*(size_t*)res = n);
+	prof(prof_alloc(SLAB_NCLASS, n));
+	return (char*)res + PROF_HEAD;
 }
 
 static void* checked_realloc(void* p, size_t n) {
@@ -86,90 +277,118 @@ static void* checked_realloc(void* p, size_t n) {
 		checked_free(p);
 		return NULL;
 	}
+	if (p == NULL) return checked_malloc(n);
 	void* res = NULL;
-	
-#define try_move(y, x)						      \
-	int i##x = ((intptr_t)p - (intptr_t)pool##x ) / sizeof(p##x );\
-	if (i##x > -1 && i##x < CHUNK##x ) {			      \
-		if (n > y && n <= x) return p;			      \
-		res = checked_malloc(n);			      \
-		memcpy(res, p, (x<n)?x:n);			      \
-		return_pool##x (p);				      \
-		return res;					      \
-	} struct _
-	
-	try_move(0, 16);
-	try_move(16, 24);
-	try_move(24, 32);
-	try_move(32, 64);
-	try_move(64, 128);
-	res = realloc(p, n);
-	nukeif(!res);
+	unsigned c = slab_class(p);
+	if (c == 0) {
+		prof(prof_free(SLAB_NCLASS, *(size_t*)((char*)p - PROF_HEAD)));
+		res = realloc((char*)p - PROF_HEAD, n + PROF_HEAD);
+		nukeif(!res);
+		prof(*(size_t*)res = n);
+		prof(prof_alloc(SLAB_NCLASS, n));
+		return (char*)res + PROF_HEAD;
+	}
+	if (c == SLAB_REGION) {
+		// region objects carry no size, but the rest of their block is
+		// readable, and whatever is past the object is never looked at
+		size_t room = SLAB_SIZE - ((uintptr_t)p & (SLAB_SIZE - 1));
+		res = checked_malloc(n);
+		memcpy(res, p, (room<n)?room:n);
+		return res;
+	}
+	size_t size = slab_sizes[c-1];
+	if (n <= size && (c == 1 || n > slab_sizes[c-2])) return p;
+	res = checked_malloc(n);
+	memcpy(res, p, (size<n)?size:n);
+	checked_free(p);
 	return res;
 }
 
-static size_t checked_strlen(const char* s) {
-	nukeif(!s);
-	size_t len = 0;
-	while (*(s++)) len++;
-	return len;
+// transient memory of a call (its argument array) is bumped out of a
+// region and dropped all at once by resetting to a mark when the call
+// returns. checked_free is a no-op on it and checked_realloc moves it out,
+// so whatever outlives the call just ends up on the heap
+
+#define REGION_BIG (SLAB_SIZE/4)
+
+typedef struct rmark {
+	size_t b;
+	size_t off;
+} rmark;
+
+static struct {
+	char** p;
+	size_t len;
+	size_t cap;
+	size_t b;
+	size_t off;
+} region = {.p = NULL, .len = 0, .cap = 0, .b = 0, .off = 0};
+
+static rmark region_mark(void) {
+	return (rmark) {.b = region.b, .off = region.off};
 }
 
-static double s_tod(const char* s) {
-	nukeif(!s);
-	errno = 0;
-	if (*s == '\0') {
-		errno = EINVAL;
-		return 0.0;
+static void region_reset(rmark m) {
+	region.b = m.b;
+	region.off = m.off;
+}
+
+__attribute__((cold))
+static bool region_grow(void) {
+	if (region.len == region.cap) {
+		size_t cap = region.cap ? region.cap*2 : 8;
+		char** p = realloc(region.p, sizeof(char*)*cap);
+		if (p == NULL) return false;
+		region.p = p;
+		region.cap = cap;
 	}
-	char* end;
-	double res = strtod(s, &end);
-	if (end == s) {
-		errno = EINVAL;
-		return 0.0;
+	char* p = aligned_alloc(SLAB_SIZE, SLAB_SIZE);
+	if (p == NULL) return false;
+	if (!slab_map_set(p, SLAB_REGION)) {
+		free(p);
+		return false;
 	}
-	while ((*end == ' ' || *end == '\t') && *end != '\0') end++;
-	if (*end == '\0') return res;
-	errno = EINVAL;
-	return 0.0;
+	region.p[region.len++] = p;
+	return true;
 }
 
-static long long int s_toi(const char* s) {
-	nukeif(!s);
-	errno = 0;
-	if (*s == '\0') {
-		errno = EINVAL;
-		return 0;
+static void* region_alloc(size_t n) {
+	nukeif(!n);
+	n = (n + 7) & ~(size_t)7;
+	if (n > REGION_BIG) return checked_malloc(n);
+	while (region.b < region.len && region.off + n > SLAB_SIZE) {
+		region.b++;
+		region.off = 0;
 	}
-	char* end;
-	long long int res = strtoll(s, &end, 0);
-	if (end == s) {
-		errno = EINVAL;
-		return 0;
+	if (region.b == region.len && !region_grow()) return checked_malloc(n);
+	prof(prof_region++);
+	prof(prof_region_bytes += n);
+	void* res = region.p[region.b] + region.off;
+	region.off += n;
+	return res;
+}
+
+// the last thing allocated grows in place
+static void* region_realloc(void* p, size_t old, size_t n) {
+	if (p == NULL) return region_alloc(n);
+	if (slab_class(p) != SLAB_REGION) return checked_realloc(p, n);
+	size_t o = (old + 7) & ~(size_t)7;
+	n = (n + 7) & ~(size_t)7;
+	if (region.b < region.len && (char*)p + o == region.p[region.b] + region.off
+	    && region.off - o + n <= SLAB_SIZE) {
+		region.off = region.off - o + n;
+		return p;
 	}
-	while ((*end == ' ' || *end == '\t') && *end != '\0') end++;
-	if (*end == '\0') return res;
-	errno = EINVAL;
-	return 0;
+	void* res = region_alloc(n);
+	memcpy(res, p, old);
+	return res;
 }
 
-static size_t s_tou(const char* s) {
+static size_t checked_strlen(const char* s) {
 	nukeif(!s);
-	errno = 0;
-	if (*s == '\0') {
-		errno = EINVAL;
-		return 0;
-	}
-	char* end;
-	long long int res = strtoull(s, &end, 0);
-	if (end == s) {
-		errno = EINVAL;
-		return 0;
-	}
-	while ((*end == ' ' || *end == '\t') && *end != '\0') end++;
-	if (*end == '\0') return res;
-	errno = EINVAL;
-	return 0;
+	size_t len = 0;
+	while (*(s++)) len++;
+	return len;
 }
 
 // DATA
@@ -194,7 +413,8 @@ bool is_file = false;
 typedef enum {
 	RESULT_OK = 0,
 	RESULT_RETURN = 1,
-	RESULT_ERROR = 2
+	RESULT_ERROR = 2,
+	RESULT_TAIL = 3
 } result;
 
 result RES = RESULT_OK;
@@ -206,10 +426,24 @@ result RES = RESULT_OK;
 #define expropen '('
 #define exprclose ')'
 
+// a string or array behind a var may be shared by several vars, rc counts
+// them; whoever writes to a shared one takes a copy of it first
+
+// a heap string behind a var also keeps what it last parsed to as a
+// number, with the errno that came with it (NO_PARSE if not parsed since
+// the last write), so text used in arithmetic is only read once
+
+#define NO_PARSE 0xff
+
 typedef struct __attribute__((packed)) {
 	char* p;
 	size_t len;
 	size_t cap;
+	size_t rc;
+	double n;
+	long long int i;
+	unsigned char ne;
+	unsigned char ie;
 } string;
 
 typedef struct {
@@ -238,13 +472,234 @@ constr constr_from(string s) {
 	};
 }
 
+// number parsing straight off slices, no NUL or locale needed;
+// hex floats, inf, nan and long or extreme decimals go to strtod
+
+static const double pow10_d[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static bool s_space(char c) {
+	return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+static int s_hex(char c) {
+	if (c >= '0' && c <= '9') return c - '0';
+	c |= 0x20;
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	return -1;
+}
+
+// eight ascii digits at once
+static bool swar8(const char* p, uint64_t* out) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	if (((v + 0x4646464646464646) | (v - 0x3030303030303030)) & 0x8080808080808080) return false;
+	v -= 0x3030303030303030;
+	v = v * 10 + (v >> 8);
+	*out = ((v & 0x000000ff000000ff) * 0x000f424000000064 + ((v >> 16) & 0x000000ff000000ff) * 0x0000271000000001) >> 32;
+	return true;
+#else
+	(void)p;
+	(void)out;
+	return false;
+#endif
+}
+
+// decimal run into m; nd counts every digit, m only holds the first 19
+static const char* s_run(const char* p, const char* e, uint64_t* m, int* nd) {
+	uint64_t c;
+	while (e - p >= 8 && *nd <= 11 && swar8(p, &c)) {
+		*m = *m * 100000000 + c;
+		*nd += 8;
+		p += 8;
+	}
+	while (p < e && *p >= '0' && *p <= '9') {
+		if (*nd < 19) *m = *m * 10 + (*p - '0');
+		(*nd)++;
+		p++;
+	}
+	return p;
+}
+
+static const char* s_tod_slow(const char* s, const char* e, double* out) {
+	char buf[64];
+	size_t n = e - s;
+	char* t = n < sizeof(buf) ? buf : checked_malloc(n + 1);
+	memcpy(t, s, n);
+	t[n] = '\0';
+	char* end;
+	*out = strtod(t, &end);
+	const char* res = s + (end - t);
+	if (t != buf) checked_free(t);
+	return res;
+}
+
+// like strtod; returns s when nothing was read
+static const char* s_scand(const char* s, const char* e, double* out) {
+	const char* p = s;
+	while (p < e && s_space(*p)) p++;
+	bool neg = false;
+	if (p < e && (*p == '-' || *p == '+')) neg = *p++ == '-';
+	if (e - p > 1 && p[0] == '0' && (p[1] | 0x20) == 'x') return s_tod_slow(s, e, out);
+	uint64_t m = 0;
+	int nd = 0, ex = 0;
+	const char* q = p;
+	while (p < e && *p == '0') p++;
+	p = s_run(p, e, &m, &nd);
+	bool any = p != q;
+	if (p < e && *p == '.') {
+		q = ++p;
+		if (!m) {
+			while (p < e && *p == '0') p++;
+			ex -= p - q;
+		}
+		const char* r = p;
+		p = s_run(p, e, &m, &nd);
+		ex -= p - r;
+		any |= p != q;
+	}
+	if (!any || nd > 19) return s_tod_slow(s, e, out);
+	if (p < e && (*p | 0x20) == 'e') {
+		const char* r = p + 1;
+		bool eneg = false;
+		if (r < e && (*r == '-' || *r == '+')) eneg = *r++ == '-';
+		if (r < e && *r >= '0' && *r <= '9') {
+			int x = 0;
+			for (; r < e && *r >= '0' && *r <= '9'; r++) if (x < 100000) x = x * 10 + (*r - '0');
+			ex += eneg ? -x : x;
+			p = r;
+		}
+	}
+	// exact operands give a correctly rounded result
+	if (m > (1ull << 53) || ex < -22 || ex > 22) return s_tod_slow(s, e, out);
+	double d = ex < 0 ? (double)m / pow10_d[-ex] : (double)m * pow10_d[ex];
+	*out = neg ? -d : d;
+	return p;
+}
+
+// like strtoull in base 0; returns s when nothing was read
+static const char* s_scanu(const char* s, const char* e, uint64_t* out, bool* neg, bool* over) {
+	const char* p = s;
+	while (p < e && s_space(*p)) p++;
+	*neg = false;
+	*over = false;
+	if (p < e && (*p == '-' || *p == '+')) *neg = *p++ == '-';
+	uint64_t m = 0;
+	const char* q = p;
+	if (p < e && *p == '0') {
+		if (e - p > 2 && (p[1] | 0x20) == 'x' && s_hex(p[2]) >= 0) {
+			p += 2;
+			for (int d; p < e && (d = s_hex(*p)) >= 0; p++) {
+				if (m >> 60) *over = true;
+				m = m << 4 | d;
+			}
+		} else {
+			for (; p < e && *p >= '0' && *p <= '7'; p++) {
+				if (m >> 61) *over = true;
+				m = m << 3 | (*p - '0');
+			}
+		}
+	} else {
+		uint64_t c;
+		int nd = 0;
+		while (e - p >= 8 && nd <= 11 && swar8(p, &c)) {
+			m = m * 100000000 + c;
+			nd += 8;
+			p += 8;
+		}
+		for (; p < e && *p >= '0' && *p <= '9'; p++) {
+			if (__builtin_mul_overflow(m, 10, &m) || __builtin_add_overflow(m, *p - '0', &m)) *over = true;
+		}
+	}
+	*out = *over ? UINT64_MAX : m;
+	return p == q ? s : p;
+}
+
+// trailing blanks are fine, so is an embedded NUL
+static bool s_rest(const char* p, const char* e) {
+	while (p < e && (*p == ' ' || *p == '\t')) p++;
+	return p == e || *p == '\0';
+}
+
+static double s_tod(constr s) {
+	nukeif(!s.p);
+	errno = 0;
+	const char* e = s.p + s.len;
+	double res;
+	const char* end = s_scand(s.p, e, &res);
+	if (end != s.p && s_rest(end, e)) return res;
+	errno = EINVAL;
+	return 0.0;
+}
+
+static long long int s_toi(constr s) {
+	nukeif(!s.p);
+	errno = 0;
+	const char* e = s.p + s.len;
+	uint64_t m;
+	bool neg, over;
+	const char* end = s_scanu(s.p, e, &m, &neg, &over);
+	if (end == s.p || !s_rest(end, e)) {
+		errno = EINVAL;
+		return 0;
+	}
+	if (over || m > (uint64_t)INT64_MAX + neg) {
+		errno = ERANGE;
+		return neg ? INT64_MIN : INT64_MAX;
+	}
+	return neg ? -(long long int)(m - 1) - 1 : (long long int)m;
+}
+
+static size_t s_tou(constr s) {
+	nukeif(!s.p);
+	errno = 0;
+	const char* e = s.p + s.len;
+	uint64_t m;
+	bool neg, over;
+	const char* end = s_scanu(s.p, e, &m, &neg, &over);
+	if (end == s.p || !s_rest(end, e)) {
+		errno = EINVAL;
+		return 0;
+	}
+	if (over) errno = ERANGE;
+	return neg && !over ? -m : m;
+}
+
+static bool s_tob(constr s) {
+	nukeif(!s.p);
+	const char* e = s.p + s.len;
+	double res;
+	const char* end = s_scand(s.p, e, &res);
+	if (s_rest(end, e)) return res != 0;
+	return 1;
+}
+
+// what an array holds; a whole var, or with NANBOX a boxed 8 byte one
+#ifdef NANBOX
+typedef uint64_t elem;
+#else
+typedef struct var elem;
+#endif
+
 typedef struct __attribute__((packed)) arr {
-	struct var* p;
+	elem* p;
 	size_t len;
 	size_t cap;
+	size_t rc;
 } arr;
 
+// strings of up to SSO_MAX bytes live in the var itself, NUL terminated,
+// with SSO_MAX - len in their last byte so that a full one ends in 0 too;
+// heap strings have SSO_HEAP there instead. errors are laid out the same
+
+#define SSO_MAX 14
+#define SSO_HEAP 0xff
+
 typedef struct var {
+	union {
 	union {
 		void* _;
 		string* s;
@@ -260,7 +715,9 @@ typedef struct var {
 		FILE* fb;
 		string* e;
 	} v;
-	enum : size_t {
+	char ss[SSO_MAX + 1];
+	};
+	enum : unsigned char {
 		TYPE_NONE,
 		TYPE_STRING,
 		TYPE_NUMBER,
@@ -278,7 +735,6 @@ typedef struct var {
 } var;
 
 typedef struct frame {
-	struct frame* n;
 	var v;
 } frame;
 
@@ -288,6 +744,96 @@ static void var_clear(var* v);
 static arr arr_copy(const arr l);
 static void string_terminate(string* to);
 
+static bool var_sso(const var* v) {
+	return (unsigned char)v->ss[SSO_MAX] != SSO_HEAP;
+}
+
+#ifdef NANBOX
+
+// doubles are kept as they are, with NaNs made quiet and positive; all
+// else is a negative NaN with type + 1 in bits 48-51 over a 48 bit payload.
+// what does not fit the payload goes into a var cell on the heap
+
+#define BOX_NAN 0x7ff8000000000000ull
+#define BOX_TOP 0xfff0000000000000ull
+#define BOX_PAYLOAD 0x0000ffffffffffffull
+#define BOX_CELL 15
+#define BOX_TAG(t) (BOX_TOP | ((uint64_t)(t) << 48))
+
+static elem elem_put(var v) {
+	uint64_t b;
+	switch (v.t) {
+		case TYPE_NUMBER:
+			if (v.v.n != v.v.n) return BOX_NAN;
+			memcpy(&b, &v.v.n, sizeof(b));
+			return b;
+		case TYPE_BOOLEAN:
+			return BOX_TAG(TYPE_BOOLEAN + 1) | v.v.b;
+		case TYPE_INTEGER:
+			if (v.v.i >= -(1ll << 47) && v.v.i < (1ll << 47))
+				return BOX_TAG(TYPE_INTEGER + 1) | ((uint64_t)v.v.i & BOX_PAYLOAD);
+			break;
+		case TYPE_STRING:
+		case TYPE_ERROR:
+			if (var_sso(&v)) break;
+		default:
+			if ((v.v.u & ~BOX_PAYLOAD) == 0) return BOX_TAG(v.t + 1) | v.v.u;
+			break;
+	}
+	var* c = checked_malloc(sizeof(var));
+	*c = v;
+	nukeif((uintptr_t)c & ~BOX_PAYLOAD);
+	return BOX_TAG(BOX_CELL) | (uintptr_t)c;
+}
+
+static bool elem_cell(elem b) {
+	return (b & BOX_TAG(BOX_CELL)) == BOX_TAG(BOX_CELL);
+}
+
+// a view of b, sharing whatever b owns
+static var elem_get(elem b) {
+	var v;
+	if ((b & BOX_TOP) != BOX_TOP || b == BOX_TOP) {
+		v.t = TYPE_NUMBER;
+		memcpy(&v.v.n, &b, sizeof(b));
+		return v;
+	}
+	if (elem_cell(b)) return *(var*)(uintptr_t)(b & BOX_PAYLOAD);
+	v.t = ((b >> 48) & 15) - 1;
+	v.v.u = b & BOX_PAYLOAD;
+	if (v.t == TYPE_INTEGER) v.v.i = (long long int)(b << 16) >> 16;
+	if (v.t == TYPE_BOOLEAN) v.v.b = b & 1;
+	v.ss[SSO_MAX] = (char)SSO_HEAP;
+	return v;
+}
+
+static var elem_take(elem* b) {
+	var v = elem_get(*b);
+	if (elem_cell(*b)) checked_free((void*)(uintptr_t)(*b & BOX_PAYLOAD));
+	return v;
+}
+
+#else
+
+static elem elem_put(var v) {
+	return v;
+}
+
+static var elem_get(elem b) {
+	return b;
+}
+
+static var elem_take(elem* b) {
+	return *b;
+}
+
+#endif
+
+static void elem_kill(elem* b) {
+	var v = elem_take(b);
+	var_clear(&v);
+}
+
 static var var_copy(const var v) {
 	var res;
 	res.t = v.t;
@@ -303,14 +849,17 @@ static var var_copy(const var v) {
 			res = v;
 			break;
 		case TYPE_STRING:
-			res.v.s = checked_malloc(sizeof(string));
-			*res.v.s = string_copy(v.v.s);
-			break;
 		case TYPE_ERROR:
-			res.v.e = checked_malloc(sizeof(string));
-			*res.v.e = string_copy(v.v.e);
+			res = v;
+			if (!var_sso(&v)) v.v.s->rc++;
 			break;
 		case TYPE_ARRAY:
+			// argument arrays go away with their region
+			if (slab_class(v.v.a) != SLAB_REGION) {
+				res = v;
+				v.v.a->rc++;
+				break;
+			}
 			res.v.a = checked_malloc(sizeof(arr));
 			*res.v.a = arr_copy(*v.v.a);
 			break;
@@ -323,9 +872,10 @@ static var var_copy(const var v) {
 static arr arr_copy(const arr l) {
 	arr res;
 	res = l;
-	res.p = checked_malloc(sizeof(var)*res.cap);
+	res.rc = 1;
+	res.p = checked_malloc(sizeof(elem)*res.cap);
 	for (size_t i = 0; i < res.len; i++) {
-		res.p[i] = var_copy(l.p[i]);
+		res.p[i] = elem_put(var_copy(elem_get(l.p[i])));
 	}
 	return res;
 }
@@ -333,22 +883,48 @@ static arr arr_copy(const arr l) {
 static void arr_clear(arr* l) {
 	nukeif(!l);
 	for (size_t i = 0; i < l->len; i++) {
-		var_clear(&l->p[i]);
+		elem_kill(&l->p[i]);
 	}
 	l->len = 0;
 	l->cap = 0;
 	if (l->p) checked_free(l->p);
 }
 
+static arr* arr_new(void) {
+	arr* res = checked_malloc(sizeof(arr));
+	res->p = NULL;
+	res->len = 0;
+	res->cap = 0;
+	res->rc = 1;
+	return res;
+}
+
+static void arr_drop(arr* l) {
+	nukeif(!l);
+	if (--l->rc) return;
+	arr_clear(l);
+	checked_free(l);
+}
+
+// the array of v, unshared so it can be written to
+static arr* var_arrw(var* v) {
+	if (v->v.a->rc == 1) return v->v.a;
+	v->v.a->rc--;
+	arr* res = checked_malloc(sizeof(arr));
+	*res = arr_copy(*v->v.a);
+	v->v.a = res;
+	return res;
+}
+
 static void arr_append(arr* l, var v) {
 	nukeif(!l);
 	l->len++;
 	if (l->len > l->cap) {
 		if (l->cap == 0) l->cap = 8;
 		else l->cap *= 2;
-		l->p = checked_realloc(l->p, sizeof(var)*l->cap);
+		l->p = checked_realloc(l->p, sizeof(elem)*l->cap);
 	}
-	l->p[l->len-1] = v;
+	l->p[l->len-1] = elem_put(v);
 }
 
 static void arr_insert(arr* l, size_t n, var v) {
@@ -361,26 +937,26 @@ static void arr_insert(arr* l, size_t n, var v) {
 	if (l->len > l->cap) {
 		if (l->cap == 0) l->cap = 8;
 		else l->cap *= 2;
-		l->p = checked_realloc(l->p, sizeof(var)*l->cap);
+		l->p = checked_realloc(l->p, sizeof(elem)*l->cap);
 	}
 	for (size_t i = l->len-1; i > n; i--) {
 		l->p[i] = l->p[i-1];
 	}
-	l->p[n] = v;
+	l->p[n] = elem_put(v);
 }
 
 static void arr_remove(arr* l, size_t i) {
 	nukeif(!l);
 	if (i >= l->len) return;
 	l->len--;
-	var_clear(&l->p[i]);
+	elem_kill(&l->p[i]);
 	for (size_t x = i; x < l->len; x++) {
 		l->p[x] = l->p[x+1];
 	}
 	if (l->len) {
 		if (l->len < l->cap/2 && l->len > 4) {
 			l->cap /= 2;
-			l->p = checked_realloc(l->p, sizeof(var)*l->cap);
+			l->p = checked_realloc(l->p, sizeof(elem)*l->cap);
 		}
 	} else {
 		l->cap = 0;
@@ -398,14 +974,14 @@ static var arr_pop(arr* l, size_t i) {
 		return res;
 	}
 	l->len--;
-	res = l->p[i];
+	res = elem_take(&l->p[i]);
 	for (size_t x = i; x < l->len; x++) {
 		l->p[x] = l->p[x+1];
 	}
 	if (l->len) {
 		if (l->len < l->cap/2 && l->len > 4) {
 			l->cap /= 2;
-			l->p = checked_realloc(l->p, sizeof(var)*l->cap);
+			l->p = checked_realloc(l->p, sizeof(elem)*l->cap);
 		}
 	} else {
 		checked_free(l->p);
@@ -435,6 +1011,16 @@ static string string_copy(const string* from) {
 	return res;
 }
 
+// capacity doubles, so appending in a loop (repeat and while collapsing
+// every pass into their frame) stays linear in the output
+__attribute__((cold))
+static void string_grow(string* to, size_t n) {
+	if (to->cap == 0) to->cap = 16;
+	while (to->len + n > to->cap)
+		to->cap *= 2;
+	to->p = checked_realloc(to->p, to->cap);
+}
+
 __attribute__((hot))
 static void string_pushc(string* to, const char c) {
 	nukeif(!to);
@@ -458,28 +1044,157 @@ static void string_pushs(string* to, const char* s) {
 	nukeif(!to);
 	nukeif(!s);
 	size_t slen = checked_strlen(s);
-	while (to->len + slen > to->cap)
-		to->cap *= 2;
-	to->p = checked_realloc(to->p, to->cap);
+	if (to->len + slen > to->cap) string_grow(to, slen);
 	memcpy(to->p + to->len, s, slen);
 	to->len += slen;
 }
 
+static void string_pushn(string* to, const char* s, size_t n) {
+	nukeif(!to);
+	nukeif(!s);
+	if (to->len + n > to->cap) string_grow(to, n);
+	memcpy(to->p + to->len, s, n);
+	to->len += n;
+}
+
 static void string_cat(string* restrict to, const string* from) {
 	nukeif(!to);
 	nukeif(!from);
-	if (to->len + from->len > to->cap) {
-		to->cap = to->len + from->len;
-		to->p = checked_realloc(to->p, to->cap);
-	}
+	if (to->len + from->len > to->cap) string_grow(to, from->len);
 	memcpy(to->p + to->len, from->p, from->len);
 	to->len += from->len;
 }
 
+static size_t sso_len(const var* v) {
+	return SSO_MAX - (unsigned char)v->ss[SSO_MAX];
+}
+
+static void sso_set(var* v, size_t len) {
+	v->ss[len] = '\0';
+	v->ss[SSO_MAX] = SSO_MAX - len;
+}
+
+// makes v a string owning s
+static void var_sets(var* v, string s) {
+	v->t = TYPE_STRING;
+	v->v.s = checked_malloc(sizeof(string));
+	v->v.s->p = s.p;
+	v->v.s->len = s.len;
+	v->v.s->cap = s.cap;
+	v->v.s->rc = 1;
+	v->v.s->ne = NO_PARSE;
+	v->v.s->ie = NO_PARSE;
+	v->ss[SSO_MAX] = (char)SSO_HEAP;
+}
+
+// makes v a string holding a copy of n bytes at s
+static void var_setn(var* v, const char* s, size_t n) {
+	if (n <= SSO_MAX) {
+		v->t = TYPE_STRING;
+		if (n) memcpy(v->ss, s, n);
+		sso_set(v, n);
+		return;
+	}
+	string res;
+	res.len = n;
+	res.cap = 16;
+	while (res.cap <= res.len) res.cap*=2;
+	res.p = checked_malloc(res.cap);
+	memcpy(res.p, s, n);
+	var_sets(v, res);
+}
+
+static constr var_cs(var* v) {
+	if (var_sso(v)) return (constr) {.p = v->ss, .len = sso_len(v)};
+	return constr_from(*v->v.s);
+}
+
+static char* var_cstr(var* v) {
+	if (var_sso(v)) return v->ss;
+	string_terminate(v->v.s);
+	return v->v.s->p;
+}
+
+// the heap string of v, unshared so it can be written to; inline strings
+// are moved out to the heap, keeping their type
+static string* var_heaps(var* v) {
+	if (!var_sso(v)) {
+		if (v->v.s->rc == 1) {
+			v->v.s->ne = NO_PARSE;
+			v->v.s->ie = NO_PARSE;
+			return v->v.s;
+		}
+		v->v.s->rc--;
+		string* res = checked_malloc(sizeof(string));
+		*res = string_copy(v->v.s);
+		res->rc = 1;
+		res->ne = NO_PARSE;
+		res->ie = NO_PARSE;
+		v->v.s = res;
+		return res;
+	}
+	string res;
+	res.len = sso_len(v);
+	res.cap = 16;
+	res.p = checked_malloc(res.cap);
+	memcpy(res.p, v->ss, res.len + 1);
+	res.rc = 1;
+	res.ne = NO_PARSE;
+	res.ie = NO_PARSE;
+	v->v.s = checked_malloc(sizeof(string));
+	*v->v.s = res;
+	v->ss[SSO_MAX] = (char)SSO_HEAP;
+	return v->v.s;
+}
+
+__attribute__((hot))
+static void var_pushn(var* v, const char* s, size_t n) {
+	if (var_sso(v)) {
+		size_t len = sso_len(v);
+		if (len + n <= SSO_MAX) {
+			memcpy(v->ss + len, s, n);
+			sso_set(v, len + n);
+			return;
+		}
+	}
+	string_pushn(var_heaps(v), s, n);
+}
+
+__attribute__((hot))
+static void var_pushc(var* v, const char c) {
+	if (var_sso(v)) {
+		size_t len = sso_len(v);
+		if (len < SSO_MAX) {
+			v->ss[len] = c;
+			sso_set(v, len + 1);
+			return;
+		}
+	}
+	string_pushc(var_heaps(v), c);
+}
+
+static void var_pushs(var* v, const char* s) {
+	if (var_sso(v)) {
+		var_pushn(v, s, checked_strlen(s));
+		return;
+	}
+	string_pushs(var_heaps(v), s);
+}
+
+static void var_cat(var* restrict to, var* from) {
+	constr c = var_cs(from);
+	if (var_sso(to) && sso_len(to) + c.len <= SSO_MAX) {
+		var_pushn(to, c.p, c.len);
+		return;
+	}
+	string_cat(var_heaps(to), &(string) {.p = c.p, .len = c.len, .cap = c.len});
+}
+
 static void f_push(void);
 static void f_free(void);
 static void f_collapse(void);
 static void f_pushc(char c);
+static void f_pushn(const char* s, size_t n);
 static void f_pushs(const char* s);
 static void f_replaces(const char* s);
 static void f_replaceu(size_t n);
@@ -523,141 +1238,306 @@ typedef struct {
 	} t;
 } meth;
 
-int meth_cmp(void* restrict l, void* r) {
-	nukeif(!l);
-	nukeif(!r);
-	return constrcmp((*(meth*)l).k, (*(meth*)r).k);
-}
-
 void meth_kill(void* x) {
 	nukeif(!x);
 	meth* m = x;
-	if (m->t != METHOD_FUNCP) {
-		checked_free(m->k.p);
-		checked_free(m);
-	}
+	if (m->t != METHOD_FUNCP) checked_free(m);
 }
 
-typedef struct __attribute__((packed)) {
+// scopes are hash tables probed a group of 16 slots at a time: a control
+// byte per slot holds the top 7 bits of the hash, MAP_EMPTY or MAP_DEAD for
+// a removed record a probe must go past, the full hash sits next to the
+// record. Records are the callers' own (token, meth, lib),
+// each starting with its constr key, and stay where they were allocated so
+// pointers to them survive inserts.
+
+#define MAP_EMPTY 0x80
+#define MAP_DEAD 0xFE
+#define MAP_GROUP 16
+
+typedef struct {
+	size_t h;
+	void* v;
+} mapslot;
+
+typedef struct {
 	size_t len;
+	size_t dead;
 	size_t cap;
-	void** v;
+	uint8_t* ctrl;
+	mapslot* s;
 	void (*kill)(void*);
-	int (*cmp)(void*, void*);
 } flatmap;
 
+// a symbol is a name with the stack of its live bindings, innermost last.
+// symbols are interned: made the first time a name is seen and kept while
+// bound or held (refs) by a call site, so records borrow their key from it
+typedef struct {
+	void* v;
+	size_t depth;
+} binding;
+
+typedef struct {
+	constr k;
+	size_t len;
+	size_t cap;
+	size_t refs;
+	binding* b;
+} symbol;
+
+// deep binding: one table of symbols for all scopes, so a lookup is a
+// single probe however deep the calls go. Scope depth counts the scopes
+// entered, log lists the symbols bound in each (from marks[depth]) so
+// leaving a scope pops exactly those
 typedef struct {
+	flatmap names;
+	size_t depth;
 	size_t len;
 	size_t cap;
-	flatmap* p;
+	symbol** log;
+	size_t mcap;
+	size_t* marks;
 	void (*kill)(void*);
-	int (*cmp)(void*, void*);
 } flatmaps;
 
-static flatmap flatmap_init(void(*kill)(void*), int(*cmp)(void*, void*), size_t cap) {
+static size_t key_hash(constr k) {
+	uint64_t h = 0x9E3779B97F4A7C15ull ^ k.len;
+	uint64_t x;
+	size_t i = 0;
+	for (; i + 8 <= k.len; i += 8) {
+		memcpy(&x, k.p + i, 8);
+		h = (h ^ x) * 0xBF58476D1CE4E5B9ull;
+		h ^= h >> 31;
+	}
+	x = 0;
+	memcpy(&x, k.p + i, k.len - i);
+	h = (h ^ x) * 0x94D049BB133111EBull;
+	h ^= h >> 29;
+	h *= 0xBF58476D1CE4E5B9ull;
+	return h ^ (h >> 32);
+}
+
+#if defined(__SSE2__)
+static unsigned map_match(const uint8_t* g, uint8_t c) {
+	return (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)g), _mm_set1_epi8((char)c)));
+}
+#else
+static unsigned map_match(const uint8_t* g, uint8_t c) {
+	unsigned res = 0;
+	for (int i = 0; i < MAP_GROUP; i++) res |= (unsigned)(g[i] == c) << i;
+	return res;
+}
+#endif
+
+static void flatmap_alloc(flatmap* x, size_t cap) {
+	x->cap = cap;
+	x->ctrl = checked_malloc(cap);
+	memset(x->ctrl, MAP_EMPTY, cap);
+	x->s = checked_malloc(sizeof(mapslot)*cap);
+}
+
+static flatmap flatmap_init(void(*kill)(void*), size_t cap) {
 	flatmap res;
 	res.len = 0;
-	res.cap = cap;
-	if (cap != 0) res.v = checked_malloc(sizeof(void*)*res.cap);
-	else res.v = NULL;
+	res.dead = 0;
+	res.cap = 0;
+	res.ctrl = NULL;
+	res.s = NULL;
 	res.kill = kill;
-	res.cmp = cmp;
+	if (cap != 0) {
+		size_t n = MAP_GROUP;
+		while (n*7 < cap*8) n *= 2;
+		flatmap_alloc(&res, n);
+	}
 	return res;
 }
 
-static void flatmap_insert(flatmap* x, void* y) {
-	nukeif(!x);
-	nukeif(!y);
-	if (x->len == 0) {
-		if (x->cap == 0) {
-			x->cap = 8;
-			x->v = checked_malloc(sizeof(void*)*x->cap);
+static mapslot* flatmap_slot(flatmap* x, constr k, size_t h) {
+	uint8_t h2 = h >> 57;
+	size_t mask = x->cap/MAP_GROUP - 1;
+	for (size_t g = h & mask;; g = (g + 1) & mask) {
+		uint8_t* c = x->ctrl + g*MAP_GROUP;
+		for (unsigned m = map_match(c, h2); m; m &= m - 1) {
+			mapslot* s = &x->s[g*MAP_GROUP + __builtin_ctz(m)];
+			constr sk = *(constr*)s->v;
+			if (s->h == h && sk.len == k.len && (sk.p == k.p || memcmp(sk.p, k.p, k.len) == 0)) return s;
 		}
-		x->len++;
-		x->v[0] = y;
+		if (map_match(c, MAP_EMPTY)) return NULL;
+	}
+}
+
+static void flatmap_place(flatmap* x, size_t h, void* y) {
+	size_t mask = x->cap/MAP_GROUP - 1;
+	for (size_t g = h & mask;; g = (g + 1) & mask) {
+		unsigned m = map_match(x->ctrl + g*MAP_GROUP, MAP_EMPTY);
+		if (m == 0) continue;
+		size_t i = g*MAP_GROUP + __builtin_ctz(m);
+		x->ctrl[i] = h >> 57;
+		x->s[i] = (mapslot) {.h = h, .v = y};
 		return;
 	}
-	long long int start = 0;
-	long long int end = x->len - 1;
-	long long int mid = 0;
-	do {
-		mid = (start + end)/2;
-		if (x->cmp(x->v[mid], y) < 0) {
-			start = mid + 1;
-			mid++;
-			continue;
-		}
-		if (x->cmp(x->v[mid], y) == 0) {
-			x->kill(x->v[mid]);
-			x->v[mid] = y;
+}
+
+static void flatmap_insert(flatmap* x, void* y) {
+	nukeif(!x);
+	nukeif(!y);
+	constr k = *(constr*)y;
+	size_t h = key_hash(k);
+	if (x->len) {
+		mapslot* s = flatmap_slot(x, k, h);
+		if (s) {
+			x->kill(s->v);
+			s->v = y;
 			return;
 		}
-		if (x->cmp(x->v[mid], y) > 0) {
-			end = mid - 1;
-			continue;
-		}
-	} while (start <= end);
-	x->len++;
-	if (x->len > x->cap) {
-		x->cap *= 2;
-		x->v = checked_realloc(x->v, sizeof(void*)*x->cap);
 	}
-	for (size_t i = x->len-1; i > mid; i--) {
-		x->v[i] = x->v[i-1];
+	if ((x->len + x->dead + 1)*8 > x->cap*7) {
+		flatmap old = *x;
+		size_t cap = old.cap ? old.cap : MAP_GROUP;
+		if ((x->len + 1)*16 > cap*7) cap *= 2;
+		flatmap_alloc(x, cap);
+		x->dead = 0;
+		for (size_t i = 0; i < old.cap; i++)
+			if (old.ctrl[i] < MAP_EMPTY) flatmap_place(x, old.s[i].h, old.s[i].v);
+		if (old.ctrl) {
+			checked_free(old.ctrl);
+			checked_free(old.s);
+		}
 	}
-	x->v[mid] = y;
+	flatmap_place(x, h, y);
+	x->len++;
 }
 
-static void* flatmap_search(flatmap* x, void* y) {
+static void* flatmap_search(flatmap* x, constr k, size_t h) {
 	nukeif(!x);
-	nukeif(!y);
-	void* res;
-	long long int start = 0;
-	long long int end = x->len - 1;
-	long long int mid = 0;
-	while (start <= end) {
-		mid = (start + end)/2;
-		if (x->cmp(x->v[mid], y) < 0) {
-			start = mid + 1;
-			continue;
-		}
-		if (x->cmp(x->v[mid], y) == 0) {
-			res = x->v[mid];
-			return res;
-		}
-		if (x->cmp(x->v[mid], y) > 0) {
-			end = mid - 1;
-			continue;
-		}
+	if (x->len == 0) return NULL;
+	mapslot* s = flatmap_slot(x, k, h);
+	return s ? s->v : NULL;
+}
+
+// takes the record out without killing it. Groups are aligned, so a probe
+// only went on past this one if it was full; the slot can go back to empty
+// unless that is the case
+static void flatmap_remove(flatmap* x, constr k, size_t h) {
+	nukeif(!x);
+	mapslot* s = flatmap_slot(x, k, h);
+	nukeif(!s);
+	size_t i = s - x->s;
+	if (map_match(x->ctrl + i/MAP_GROUP*MAP_GROUP, MAP_EMPTY)) {
+		x->ctrl[i] = MAP_EMPTY;
+	} else {
+		x->ctrl[i] = MAP_DEAD;
+		x->dead++;
 	}
-	return NULL;
+	x->len--;
 }
 
 static void flatmap_kill(flatmap* x) {
 	nukeif(!x);
-	for (size_t i = 0; i < x->len; i++) {
-		x->kill(x->v[i]);
+	for (size_t i = 0; i < x->cap; i++) {
+		if (x->ctrl[i] < MAP_EMPTY) x->kill(x->s[i].v);
+	}
+	if (x->ctrl) {
+		checked_free(x->ctrl);
+		checked_free(x->s);
 	}
-	if (x->v) checked_free(x->v);
 }
 
-static void flatmaps_push(flatmaps* x, size_t cap) {
+void symbol_kill(void* x) {
 	nukeif(!x);
-	x->len++;
-	if (x->len == 1) x->p = checked_malloc(sizeof(flatmap));
-	else x->p = checked_realloc(x->p, sizeof(flatmap)*x->len);
-	x->p[x->len-1] = flatmap_init(x->kill, x->cmp, cap);
+	symbol* sym = x;
+	checked_free(sym->k.p);
+	if (sym->b) checked_free(sym->b);
+	checked_free(sym);
+}
+
+static symbol* flatmaps_intern(flatmaps* x, constr k) {
+	nukeif(!x);
+	size_t h = key_hash(k);
+	symbol* sym = flatmap_search(&x->names, k, h);
+	if (sym) return sym;
+	sym = checked_malloc(sizeof(symbol));
+	sym->k.p = checked_malloc(k.len + 1);
+	memcpy(sym->k.p, k.p, k.len);
+	sym->k.p[k.len] = '\0';
+	sym->k.len = k.len;
+	sym->len = 0;
+	sym->cap = 0;
+	sym->refs = 0;
+	sym->b = NULL;
+	flatmap_insert(&x->names, sym);
+	return sym;
+}
+
+// a symbol nothing is bound to or holds goes, so names made up at run time
+// do not pile up
+static void flatmaps_reclaim(flatmaps* x, symbol* sym) {
+	nukeif(!x);
+	nukeif(!sym);
+	if (sym->len || sym->refs) return;
+	flatmap_remove(&x->names, sym->k, key_hash(sym->k));
+	symbol_kill(sym);
+}
+
+static void flatmaps_release(flatmaps* x, symbol* sym) {
+	nukeif(!sym);
+	sym->refs--;
+	flatmaps_reclaim(x, sym);
+}
+
+static void* symbol_top(symbol* sym) {
+	return sym->len ? sym->b[sym->len-1].v : NULL;
+}
+
+// binds y, whose key is borrowed from sym, in the current scope
+static void flatmaps_bind(flatmaps* x, symbol* sym, void* y) {
+	nukeif(!x);
+	nukeif(!y);
+	if (sym->len && sym->b[sym->len-1].depth == x->depth) {
+		x->kill(sym->b[sym->len-1].v);
+		sym->b[sym->len-1].v = y;
+		return;
+	}
+	if (sym->len == sym->cap) {
+		sym->cap = sym->cap ? sym->cap*2 : 2;
+		sym->b = checked_realloc(sym->b, sizeof(binding)*sym->cap);
+	}
+	sym->b[sym->len++] = (binding) {.v = y, .depth = x->depth};
+	if (x->len == x->cap) {
+		x->cap = x->cap ? x->cap*2 : 64;
+		x->log = checked_realloc(x->log, sizeof(symbol*)*x->cap);
+	}
+	x->log[x->len++] = sym;
+}
+
+static void flatmaps_push(flatmaps* x) {
+	nukeif(!x);
+	if (x->depth == 0) x->names = flatmap_init(symbol_kill, 64);
+	if (x->depth == x->mcap) {
+		x->mcap = x->mcap ? x->mcap*2 : 64;
+		x->marks = checked_realloc(x->marks, sizeof(size_t)*x->mcap);
+	}
+	x->marks[x->depth++] = x->len;
 }
 
 static void flatmaps_free(flatmaps* x) {
 	nukeif(!x);
-	if (x->len == 0) return;
-	x->len--;
-	flatmap_kill(&x->p[x->len]);
-	if (x->len)
-		x->p = checked_realloc(x->p, sizeof(flatmap)*x->len);
-	else
-		checked_free(x->p);
+	if (x->depth == 0) return;
+	size_t mark = x->marks[--x->depth];
+	while (x->len > mark) {
+		symbol* sym = x->log[--x->len];
+		x->kill(sym->b[--sym->len].v);
+		if (x->depth) flatmaps_reclaim(x, sym);
+	}
+	if (x->depth == 0) {
+		flatmap_kill(&x->names);
+		if (x->log) checked_free(x->log);
+		if (x->marks) checked_free(x->marks);
+		x->log = NULL;
+		x->marks = NULL;
+		x->cap = 0;
+		x->mcap = 0;
+	}
 }
 
 void token_kill(void* n) {
@@ -666,17 +1546,380 @@ void token_kill(void* n) {
 	if (temp->t == TOKEN_VAR) {
 		var_clear(&temp->p.v);
 	}
-	if (temp->t != TOKEN_FUNCP) {
-		checked_free(temp->k.p);
-		checked_free(temp);
+	if (temp->t != TOKEN_FUNCP) checked_free(temp);
+}
+
+// a block is one argument of a source buffer lexed ahead of time: the
+// literal runs (escapes already split out) and the brackets it opens,
+// so running it again does not look at the text char by char
+
+// what a call site with a plain-text head resolves through: the builtin it
+// names, which cannot be shadowed, or else the symbol of its name, whose
+// innermost binding is the token in scope
+typedef struct {
+	token* t;
+	symbol* s;
+} icache;
+
+typedef struct {
+	char* p;
+	size_t len;
+	size_t n;
+	icache ic;
+	enum {
+		OP_TEXT,
+		OP_CALL,
+		OP_TOKEN,
+		OP_END
+	} t;
+	bool tail;
+} op;
+
+typedef struct {
+	char* k;
+	char* end;
+	size_t len;
+	size_t cap;
+	op* ops;
+} block;
+
+// an arithmetic operand; integral values stay integers until an overflow
+// or a fraction pushes them to double
+typedef struct {
+	enum : unsigned char {
+		AR_NUM,
+		AR_INT,
+		AR_UINT
+	} t;
+	union {
+		long long int i;
+		size_t u;
+	};
+	double n;
+} arith;
+
+typedef struct {
+	char* p;
+	size_t len;
+	double n;
+	long long int i;
+	bool b;
+	arith a;
+} xlit;
+
+typedef struct {
+	union {
+		xlit l;
+		struct {
+			char* p;
+			size_t len;
+			size_t n;
+			icache ic;
+		} c;
+	};
+	enum {
+		X_LIT,
+		X_NONE,
+		X_CALL,
+		X_NOT,
+		X_INV,
+		X_POW,
+		X_MUL,
+		X_DIV,
+		X_MOD,
+		X_ADD,
+		X_SUB,
+		X_SHL,
+		X_SHR,
+		X_AND,
+		X_XOR,
+		X_OR,
+		X_LAND,
+		X_LOR,
+		X_EQ,
+		X_NE,
+		X_LT,
+		X_LE,
+		X_GT,
+		X_GE
+	} t;
+} xop;
+
+// an expression compiled to postfix; a program that could not be compiled
+// is kept with fallback set so it is not retried
+typedef struct {
+	char* k;
+	char* end;
+	size_t len;
+	size_t cap;
+	size_t depth;
+	bool fallback;
+	xop* ops;
+} xprog;
+
+// open addressing table keyed by the first member (char* k) of its entries
+typedef struct {
+	size_t count;
+	size_t cap;
+	void** v;
+} cache;
+
+// structural index: one bit for every unescaped '{', ';' and '}', the
+// number of those before each 64 byte word, and for each of them the
+// offset where raw_skip started right after it stops
+typedef struct {
+	uint64_t* bits;
+	uint32_t* rank;
+	uint32_t* skip;
+} sindex;
+
+typedef struct {
+	char* p;
+	size_t len;
+	cache blocks;
+	cache exprs;
+	bool indexed;
+	sindex idx;
+} source;
+
+typedef struct {
+	size_t len;
+	size_t cap;
+	source* p;
+} srclist;
+
+srclist srcs = {
+	.len = 0,
+	.cap = 0,
+	.p = NULL
+};
+
+static size_t ptr_hash(const char* p) {
+	return (size_t)(((uintptr_t)p * 0x9E3779B97F4A7C15ull) >> 17);
+}
+
+static void* cache_find(cache* c, const char* k) {
+	if (c->count == 0) return NULL;
+	size_t mask = c->cap - 1;
+	for (size_t i = ptr_hash(k) & mask;; i = (i + 1) & mask) {
+		void* e = c->v[i];
+		if (e == NULL) return NULL;
+		if (*(char**)e == k) return e;
 	}
 }
 
-__attribute__((hot))
-int token_cmp(void* restrict l, void* r) {
-	nukeif(!l);
-	nukeif(!r);
-	return constrcmp((*(token*)l).k, (*(token*)r).k);
+static void cache_insert(cache* c, void* e) {
+	if ((c->count + 1)*2 > c->cap) {
+		size_t cap = c->cap ? c->cap*2 : 64;
+		void** v = checked_malloc(sizeof(void*)*cap);
+		memset(v, 0, sizeof(void*)*cap);
+		for (size_t j = 0; j < c->cap; j++) {
+			if (c->v[j] == NULL) continue;
+			size_t i = ptr_hash(*(char**)c->v[j]) & (cap - 1);
+			while (v[i]) i = (i + 1) & (cap - 1);
+			v[i] = c->v[j];
+		}
+		if (c->v) checked_free(c->v);
+		c->v = v;
+		c->cap = cap;
+	}
+	size_t i = ptr_hash(*(char**)e) & (c->cap - 1);
+	while (c->v[i]) i = (i + 1) & (c->cap - 1);
+	c->v[i] = e;
+	c->count++;
+}
+
+static void cache_kill(cache* c, void(*kill)(void*)) {
+	for (size_t j = 0; j < c->cap; j++)
+		if (c->v[j]) kill(c->v[j]);
+	if (c->v) checked_free(c->v);
+	c->v = NULL;
+	c->count = 0;
+	c->cap = 0;
+}
+
+static void source_push(char* p) {
+	nukeif(!p);
+	srclist* x = &srcs;
+	if (x->len == x->cap) {
+		x->cap = x->cap ? x->cap*2 : 4;
+		x->p = checked_realloc(x->p, sizeof(source)*x->cap);
+	}
+	source* s = &x->p[x->len++];
+	s->p = p;
+	s->len = checked_strlen(p);
+	s->blocks = (cache) {.count = 0, .cap = 0, .v = NULL};
+	s->exprs = (cache) {.count = 0, .cap = 0, .v = NULL};
+	s->indexed = false;
+	s->idx = (sindex) {.bits = NULL, .rank = NULL, .skip = NULL};
+}
+
+extern flatmaps tokens;
+
+// call sites hold the symbol of their head until their source goes
+static void block_kill(void* x) {
+	nukeif(!x);
+	block* b = x;
+	for (size_t i = 0; i < b->len; i++)
+		if (b->ops[i].ic.s) flatmaps_release(&tokens, b->ops[i].ic.s);
+	if (b->ops) checked_free(b->ops);
+	checked_free(b);
+}
+
+static void xprog_kill(void* x) {
+	nukeif(!x);
+	xprog* e = x;
+	for (size_t i = 0; i < e->len; i++) {
+		if (e->ops[i].t == X_LIT) checked_free(e->ops[i].l.p);
+		if (e->ops[i].t == X_CALL && e->ops[i].c.ic.s) flatmaps_release(&tokens, e->ops[i].c.ic.s);
+	}
+	if (e->ops) checked_free(e->ops);
+	checked_free(e);
+}
+
+static void source_drop(char* p) {
+	srclist* x = &srcs;
+	for (size_t i = x->len; i-- > 0;) {
+		if (x->p[i].p != p) continue;
+		source* s = &x->p[i];
+		cache_kill(&s->blocks, block_kill);
+		cache_kill(&s->exprs, xprog_kill);
+		if (s->idx.bits) checked_free(s->idx.bits);
+		if (s->idx.rank) checked_free(s->idx.rank);
+		if (s->idx.skip) checked_free(s->idx.skip);
+		x->len--;
+		memmove(s, s + 1, sizeof(source)*(x->len - i));
+		if (x->len == 0) {
+			checked_free(x->p);
+			x->p = NULL;
+			x->cap = 0;
+		}
+		return;
+	}
+}
+
+static source* source_of(const char* p) {
+	srclist* x = &srcs;
+	for (size_t i = x->len; i-- > 0;) {
+		source* s = &x->p[i];
+		if (p >= s->p && p <= s->p + s->len) return s;
+	}
+	return NULL;
+}
+
+// bit i is set when p[i] == c, for 64 bytes
+#if defined(__AVX2__)
+static uint64_t scan_eq(const char* p, char c) {
+	__m256i k = _mm256_set1_epi8(c);
+	uint64_t lo = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)p), k));
+	uint64_t hi = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(p + 32)), k));
+	return lo | hi << 32;
+}
+#elif defined(__SSE2__)
+static uint64_t scan_eq(const char* p, char c) {
+	__m128i k = _mm_set1_epi8(c);
+	uint64_t res = 0;
+	for (int i = 0; i < 4; i++)
+		res |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + 16*i)), k)) << 16*i;
+	return res;
+}
+#else
+static uint64_t scan_eq(const char* p, char c) {
+	uint64_t res = 0;
+	for (int i = 0; i < 64; i++) res |= (uint64_t)(p[i] == c) << i;
+	return res;
+}
+#endif
+
+// bytes escaped by a backslash; a run of backslashes escapes the byte after
+// it when its length is odd, and a run may carry over from the last block
+static uint64_t scan_escaped(uint64_t bs, uint64_t* carry) {
+	const uint64_t even = 0x5555555555555555ull;
+	bs &= ~*carry;
+	uint64_t follows = bs << 1 | *carry;
+	uint64_t odd_starts = bs & ~even & ~follows;
+	uint64_t even_runs;
+	*carry = __builtin_add_overflow(odd_starts, bs, &even_runs);
+	return (even ^ (even_runs << 1)) & follows;
+}
+
+static void source_index(source* s) {
+	s->indexed = true;
+	if (s->len >= UINT32_MAX) return;
+	sindex* x = &s->idx;
+	size_t words = s->len/64 + 1;
+	x->bits = checked_malloc(sizeof(uint64_t)*words);
+	x->rank = checked_malloc(sizeof(uint32_t)*words);
+	char tail[64];
+	uint64_t carry = 0;
+	uint32_t n = 0;
+	for (size_t i = 0; i < words; i++) {
+		const char* p = s->p + i*64;
+		if (i*64 + 64 > s->len) {
+			memset(tail, 0, 64);
+			memcpy(tail, p, s->len - i*64);
+			p = tail;
+		}
+		uint64_t escaped = scan_escaped(scan_eq(p, '\\'), &carry);
+		x->bits[i] = (scan_eq(p, open) | scan_eq(p, next) | scan_eq(p, close)) & ~escaped;
+		x->rank[i] = n;
+		n += __builtin_popcountll(x->bits[i]);
+	}
+	x->skip = checked_malloc(sizeof(uint32_t)*(n + 1));
+	// pending[d] is the structural waiting for the next ';' or '}' at depth d
+	size_t depth = 0;
+	size_t cap = 16;
+	uint32_t* pending = checked_malloc(sizeof(uint32_t)*cap);
+	pending[0] = UINT32_MAX;
+	uint32_t k = 0;
+	for (size_t i = 0; i < words; i++) {
+		for (uint64_t b = x->bits[i]; b; b &= b - 1, k++) {
+			uint32_t pos = i*64 + __builtin_ctzll(b);
+			x->skip[k] = pos;
+			switch (s->p[pos]) {
+				case open:
+					if (++depth == cap) {
+						cap *= 2;
+						pending = checked_realloc(pending, sizeof(uint32_t)*cap);
+					}
+					pending[depth] = k;
+					break;
+				case next:
+					if (pending[depth] != UINT32_MAX) x->skip[pending[depth]] = pos;
+					pending[depth] = k;
+					break;
+				default:
+					if (pending[depth] != UINT32_MAX) x->skip[pending[depth]] = pos;
+					if (depth) depth--;
+					else pending[0] = UINT32_MAX;
+					break;
+			}
+		}
+	}
+	for (size_t d = 0; d <= depth; d++)
+		if (pending[d] != UINT32_MAX) x->skip[pending[d]] = s->len;
+	checked_free(pending);
+}
+
+// where raw_skip from just after the '{' or ';' at p stops, NULL if p is
+// not in an indexed source
+static char* source_skip(char* p) {
+	source* s = source_of(p);
+	if (s == NULL) return NULL;
+	if (!s->indexed) source_index(s);
+	sindex* x = &s->idx;
+	if (x->bits == NULL || *p == close) return NULL;
+	size_t i = p - s->p;
+	uint64_t bit = 1ull << (i%64);
+	uint64_t word = x->bits[i/64];
+	if (!(word & bit)) return NULL;
+	return s->p + x->skip[x->rank[i/64] + __builtin_popcountll(word & (bit - 1))];
+}
+
+static block* block_find(const char* k) {
+	source* s = source_of(k);
+	if (s == NULL) return NULL;
+	return cache_find(&s->blocks, k);
 }
 
 struct lib {
@@ -687,40 +1930,56 @@ struct lib {
 void lib_kill(void* n) {
 	nukeif(!n);
 	struct lib* temp = n;
-	checked_free(temp->k.p);
+	source_drop(temp->v);
 	checked_free(temp->v);
 	checked_free(temp);
 }
 
-int lib_cmp(void* restrict l, void* r) {
-	nukeif(!l);
-	nukeif(!r);
-	return constrcmp((*(struct lib*)l).k, (*(struct lib*)r).k);
-}
-
 static result lib_push(char* filename);
+// frames are a contiguous stack, f is the top and f-1 its parent
+frame* fs = NULL;
+size_t fcap = 0;
 frame* f = NULL;
 char* w = NULL;
 flatmaps tokens = {
+	.depth = 0,
 	.len = 0,
-	.p = NULL,
-	.kill = token_kill,
-	.cmp = token_cmp
+	.cap = 0,
+	.log = NULL,
+	.mcap = 0,
+	.marks = NULL,
+	.kill = token_kill
 };
 flatmaps libs = {
+	.depth = 0,
 	.len = 0,
-	.p = NULL,
-	.kill = lib_kill,
-	.cmp = lib_cmp
+	.cap = 0,
+	.log = NULL,
+	.mcap = 0,
+	.marks = NULL,
+	.kill = lib_kill
 };
 flatmaps meths = {
+	.depth = 0,
 	.len = 0,
-	.p = NULL,
-	.kill = meth_kill,
-	.cmp = meth_cmp
+	.cap = 0,
+	.log = NULL,
+	.mcap = 0,
+	.marks = NULL,
+	.kill = meth_kill
 };
 var* args = NULL;
 var* self = NULL;
+
+// tail calls: fn_cur is the fun whose body runs innermost (NULL inside any
+// other body), tail_pos says the value being walked is its value, tail_in
+// hands that to a builtin, and a self call found there leaves its
+// arguments in tail_args for the fun's own loop to pick up
+token* fn_cur = NULL;
+bool tail_pos = false;
+bool tail_in = false;
+bool tail_swept = false;
+var tail_args;
 clock_t start;
 char* code_start;
 const char* splash[] = {
@@ -741,112 +2000,280 @@ const char* splash[] = {
 	"Too dynamic 4 U!"
 };
 
-token core_pool[128];
-size_t core_i = 0;
-meth core_meth_pool[128];
-size_t core_meth_i = 0;
-
-static void core_funcp_place(const char* k, result (*fp)(void)) {
-	nukeif(!k);
-	token* temp = &core_pool[core_i];
-	core_i++;
-	temp->k.p = (char*)k;
-	temp->k.len = checked_strlen(k);
-	temp->t = TOKEN_FUNCP;
-	temp->p.fp = fp;
-	flatmap_insert(&tokens.p[tokens.len-1], temp);	
-}
-
-static void meth_funcp_place(const char* k, result (*mp)(var*)) {
-	nukeif(!k);
-	meth* temp = &core_meth_pool[core_meth_i];
-	core_meth_i++;
-	temp->k.p = (char*)k;
-	temp->k.len = checked_strlen(k);
-	temp->t = METHOD_FUNCP;
-	temp->p.meth = mp;
-	flatmap_insert(&meths.p[meths.len-1], temp);
+static token* core_find(constr k);
+static meth* core_meth_find(constr k);
+
+static var* f_ref(void) {
+	return &f->v;
+}
+
+// grisu2: shortest digits that read back to the same double
+typedef struct {
+	uint64_t f;
+	int e;
+} diyfp;
+
+static const diyfp grisu_pow[] = {
+	{0xfa8fd5a0081c0288, -1220}, {0xbaaee17fa23ebf76, -1193}, {0x8b16fb203055ac76, -1166},
+	{0xcf42894a5dce35ea, -1140}, {0x9a6bb0aa55653b2d, -1113}, {0xe61acf033d1a45df, -1087},
+	{0xab70fe17c79ac6ca, -1060}, {0xff77b1fcbebcdc4f, -1034}, {0xbe5691ef416bd60c, -1007},
+	{0x8dd01fad907ffc3c, -980}, {0xd3515c2831559a83, -954}, {0x9d71ac8fada6c9b5, -927},
+	{0xea9c227723ee8bcb, -901}, {0xaecc49914078536d, -874}, {0x823c12795db6ce57, -847},
+	{0xc21094364dfb5637, -821}, {0x9096ea6f3848984f, -794}, {0xd77485cb25823ac7, -768},
+	{0xa086cfcd97bf97f4, -741}, {0xef340a98172aace5, -715}, {0xb23867fb2a35b28e, -688},
+	{0x84c8d4dfd2c63f3b, -661}, {0xc5dd44271ad3cdba, -635}, {0x936b9fcebb25c996, -608},
+	{0xdbac6c247d62a584, -582}, {0xa3ab66580d5fdaf6, -555}, {0xf3e2f893dec3f126, -529},
+	{0xb5b5ada8aaff80b8, -502}, {0x87625f056c7c4a8b, -475}, {0xc9bcff6034c13053, -449},
+	{0x964e858c91ba2655, -422}, {0xdff9772470297ebd, -396}, {0xa6dfbd9fb8e5b88f, -369},
+	{0xf8a95fcf88747d94, -343}, {0xb94470938fa89bcf, -316}, {0x8a08f0f8bf0f156b, -289},
+	{0xcdb02555653131b6, -263}, {0x993fe2c6d07b7fac, -236}, {0xe45c10c42a2b3b06, -210},
+	{0xaa242499697392d3, -183}, {0xfd87b5f28300ca0e, -157}, {0xbce5086492111aeb, -130},
+	{0x8cbccc096f5088cc, -103}, {0xd1b71758e219652c, -77}, {0x9c40000000000000, -50},
+	{0xe8d4a51000000000, -24}, {0xad78ebc5ac620000, 3}, {0x813f3978f8940984, 30},
+	{0xc097ce7bc90715b3, 56}, {0x8f7e32ce7bea5c70, 83}, {0xd5d238a4abe98068, 109},
+	{0x9f4f2726179a2245, 136}, {0xed63a231d4c4fb27, 162}, {0xb0de65388cc8ada8, 189},
+	{0x83c7088e1aab65db, 216}, {0xc45d1df942711d9a, 242}, {0x924d692ca61be758, 269},
+	{0xda01ee641a708dea, 295}, {0xa26da3999aef774a, 322}, {0xf209787bb47d6b85, 348},
+	{0xb454e4a179dd1877, 375}, {0x865b86925b9bc5c2, 402}, {0xc83553c5c8965d3d, 428},
+	{0x952ab45cfa97a0b3, 455}, {0xde469fbd99a05fe3, 481}, {0xa59bc234db398c25, 508},
+	{0xf6c69a72a3989f5c, 534}, {0xb7dcbf5354e9bece, 561}, {0x88fcf317f22241e2, 588},
+	{0xcc20ce9bd35c78a5, 614}, {0x98165af37b2153df, 641}, {0xe2a0b5dc971f303a, 667},
+	{0xa8d9d1535ce3b396, 694}, {0xfb9b7cd9a4a7443c, 720}, {0xbb764c4ca7a44410, 747},
+	{0x8bab8eefb6409c1a, 774}, {0xd01fef10a657842c, 800}, {0x9b10a4e5e9913129, 827},
+	{0xe7109bfba19c0c9d, 853}, {0xac2820d9623bf429, 880}, {0x80444b5e7aa7cf85, 907},
+	{0xbf21e44003acdd2d, 933}, {0x8e679c2f5e44ff8f, 960}, {0xd433179d9c8cb841, 986},
+	{0x9e19db92b4e31ba9, 1013}, {0xeb96bf6ebadf77d9, 1039}, {0xaf87023b9bf0ee6b, 1066},
+};
+
+static const uint64_t pow10_u[] = {
+	1ull, 10ull, 100ull, 1000ull, 10000ull, 100000ull, 1000000ull, 10000000ull,
+	100000000ull, 1000000000ull, 10000000000ull, 100000000000ull, 1000000000000ull,
+	10000000000000ull, 100000000000000ull, 1000000000000000ull, 10000000000000000ull,
+	100000000000000000ull, 1000000000000000000ull, 10000000000000000000ull
+};
+
+static const char digits2[] =
+	"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+	"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
+static diyfp diyfp_mul(diyfp x, diyfp y) {
+	uint64_t a = x.f >> 32, b = x.f & 0xffffffff;
+	uint64_t c = y.f >> 32, d = y.f & 0xffffffff;
+	uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+	uint64_t mid = (bd >> 32) + (ad & 0xffffffff) + (bc & 0xffffffff) + (1ull << 31);
+	return (diyfp){ac + (ad >> 32) + (bc >> 32) + (mid >> 32), x.e + y.e + 64};
 }
 
-static var* f_ref(void) {
-	return &f->v;
+static diyfp diyfp_norm(diyfp x) {
+	int s = __builtin_clzll(x.f);
+	return (diyfp){x.f << s, x.e - s};
 }
 
-__attribute__((hot))
-static void var_stringify(var* v) {
-	nukeif(!v);
-	if (v->t == TYPE_STRING) return;
-	string res;
-	res.len = 0;
-	res.cap = 16;
-	res.p = checked_malloc(res.cap);
-	size_t size;
+static void grisu_round(char* buf, int len, uint64_t delta, uint64_t rest, uint64_t ten_k, uint64_t wp_w) {
+	while (rest < wp_w && delta - rest >= ten_k &&
+		(rest + ten_k < wp_w || wp_w - rest > rest + ten_k - wp_w)) {
+		buf[len - 1]--;
+		rest += ten_k;
+	}
+}
+
+static int grisu_digits(diyfp w, diyfp mp, uint64_t delta, char* buf, int* k) {
+	int sh = -mp.e;
+	uint64_t one = 1ull << sh;
+	uint64_t wp_w = mp.f - w.f;
+	uint32_t p1 = (uint32_t)(mp.f >> sh);
+	uint64_t p2 = mp.f & (one - 1);
+	int kappa = 1;
+	while (kappa < 10 && p1 >= pow10_u[kappa]) kappa++;
+	int len = 0;
+	while (kappa > 0) {
+		uint32_t d = p1 / pow10_u[kappa - 1];
+		p1 %= pow10_u[kappa - 1];
+		if (d || len) buf[len++] = '0' + d;
+		kappa--;
+		uint64_t rest = ((uint64_t)p1 << sh) + p2;
+		if (rest <= delta) {
+			*k += kappa;
+			grisu_round(buf, len, delta, rest, pow10_u[kappa] << sh, wp_w);
+			return len;
+		}
+	}
+	for (;;) {
+		p2 *= 10;
+		delta *= 10;
+		char d = p2 >> sh;
+		if (d || len) buf[len++] = '0' + d;
+		p2 &= one - 1;
+		kappa--;
+		if (p2 < delta) {
+			*k += kappa;
+			grisu_round(buf, len, delta, p2, one, wp_w * pow10_u[-kappa]);
+			return len;
+		}
+	}
+}
+
+// finite, positive d only
+static int grisu2(double d, char* buf, int* k) {
+	uint64_t bits;
+	memcpy(&bits, &d, sizeof(bits));
+	int be = (bits >> 52) & 0x7ff;
+	uint64_t frac = bits & ((1ull << 52) - 1);
+	diyfp v = be ? (diyfp){frac | (1ull << 52), be - 1075} : (diyfp){frac, -1074};
+	diyfp pl = diyfp_norm((diyfp){(v.f << 1) + 1, v.e - 1});
+	diyfp mi = (v.f == (1ull << 52)) ? (diyfp){(v.f << 2) - 1, v.e - 2} : (diyfp){(v.f << 1) - 1, v.e - 1};
+	mi.f <<= mi.e - pl.e;
+	mi.e = pl.e;
+	double dk = (-61 - pl.e) * 0.30102999566398114 + 347;
+	int ki = (int)dk;
+	if (dk - ki > 0.0) ki++;
+	size_t idx = (ki >> 3) + 1;
+	*k = -(-348 + (int)idx * 8);
+	diyfp c = grisu_pow[idx];
+	diyfp w = diyfp_mul(diyfp_norm(v), c);
+	diyfp wp = diyfp_mul(pl, c);
+	diyfp wm = diyfp_mul(mi, c);
+	wm.f++;
+	wp.f--;
+	return grisu_digits(w, wp, wp.f - wm.f, buf, k);
+}
+
+// writes backwards from end, returns the start
+static char* fmt_u(char* end, uint64_t u) {
+	while (u >= 100) {
+		size_t i = (u % 100) * 2;
+		u /= 100;
+		*--end = digits2[i + 1];
+		*--end = digits2[i];
+	}
+	if (u >= 10) {
+		*--end = digits2[u * 2 + 1];
+		*--end = digits2[u * 2];
+	} else *--end = '0' + u;
+	return end;
+}
+
+static char* fmt_i(char* end, long long int i) {
+	if (i >= 0) return fmt_u(end, i);
+	end = fmt_u(end, -(uint64_t)i);
+	*--end = '-';
+	return end;
+}
+
+// d is not integral or out of integer range; buf holds at least 32
+static size_t fmt_d(char* buf, double d) {
+	char* p = buf;
+	if (isnan(d)) {
+		memcpy(buf, "nan", 3);
+		return 3;
+	}
+	if (signbit(d)) {
+		*p++ = '-';
+		d = -d;
+	}
+	if (isinf(d)) {
+		memcpy(p, "inf", 3);
+		return p - buf + 3;
+	}
+	char dg[20];
+	int k;
+	int len = grisu2(d, dg, &k);
+	int kk = len + k; // 10^(kk-1) <= d < 10^kk
+	if (len <= kk && kk <= 21) {
+		memcpy(p, dg, len);
+		memset(p + len, '0', kk - len);
+		p += kk;
+	} else if (0 < kk && kk <= 21) {
+		memcpy(p, dg, kk);
+		p[kk] = '.';
+		memcpy(p + kk + 1, dg + kk, len - kk);
+		p += len + 1;
+	} else if (-6 < kk && kk <= 0) {
+		*p++ = '0';
+		*p++ = '.';
+		memset(p, '0', -kk);
+		memcpy(p - kk, dg, len);
+		p += len - kk;
+	} else {
+		*p++ = dg[0];
+		if (len > 1) {
+			*p++ = '.';
+			memcpy(p, dg + 1, len - 1);
+			p += len - 1;
+		}
+		*p++ = 'e';
+		char e[8];
+		char* s = fmt_i(e + sizeof(e), kk - 1);
+		memcpy(p, s, e + sizeof(e) - s);
+		p += e + sizeof(e) - s;
+	}
+	return p - buf;
+}
+
+// formats a number or bool into buf, which holds at least 32
+static constr num_fmt(var* v, char* buf) {
+	char* end = buf + 32;
+	char* p;
 	switch (v->t) {
 		case TYPE_NUMBER:
-			if (floor(v->v.n) == v->v.n) {
-				goto integer;
-				return;
-			}
-			size = snprintf(res.p, res.cap, "%lf", v->v.n);
-			res.len = size;
-			while (res.cap <= res.len + 1) res.cap*=2;
-			res.p = checked_malloc(res.cap);
-			snprintf(res.p, res.cap, "%lf", v->v.n);
+			if (floor(v->v.n) != v->v.n || fabs(v->v.n) >= 0x1p63) return (constr) {.p = buf, .len = fmt_d(buf, v->v.n)};
+			p = fmt_i(end, (long long int)v->v.n);
 			break;
-		integer:
-			v->t = TYPE_INTEGER;
-			v->v.i = (long long int)v->v.n;
 		case TYPE_INTEGER:
-			size = snprintf(res.p, res.cap, "%lli", v->v.i);
-			res.len = size;
-			while (res.cap <= res.len + 1) res.cap*=2;
-			res.p = checked_malloc(res.cap);
-			snprintf(res.p, res.cap, "%lli", v->v.i);
+			p = fmt_i(end, v->v.i);
 			break;
 		case TYPE_UINTEGER:
-			size_t len = 1;
-			size_t temp = v->v.u;
-			while (temp > 9) {
-				len++;
-				temp /= 10;
-			}
-			res.len = len;
-			while (res.cap <= res.len + 1) res.cap*=2;
-			res.p = checked_malloc(res.cap);
-			sprintf(res.p, "%ld", v->v.u);
+			p = fmt_u(end, v->v.u);
 			break;
 		case TYPE_BOOLEAN:
-			if (v->v.b) {
-				res.p[0] = '1';
-				res.len = 1;
-			} else {
-				res.p[0] = '0';
-				res.len = 1;
-			}
-			break;
-		case TYPE_ARRAY:
-			arr_clear(v->v.a);
-			checked_free(v->v.a);
-		case TYPE_FUNCTION:
-		case TYPE_EXPRESSION:
-		case TYPE_MACRO:
-		case TYPE_NONE:	
+			p = end - 1;
+			*p = v->v.b ? '1' : '0';
 			break;
 		default:
-			__builtin_unreachable();
+			return (constr) {.p = buf, .len = 0};
 	}
-	v->t = TYPE_STRING;
-	v->v.s = checked_malloc(sizeof(string));
-	*v->v.s = res;
+	return (constr) {.p = p, .len = end - p};
+}
 
+__attribute__((hot))
+static void var_stringify(var* v) {
+	nukeif(!v);
+	if (v->t == TYPE_STRING) return;
+	char buf[32];
+	var old = *v;
+	constr s = num_fmt(v, buf);
+	if (v->t == TYPE_ARRAY) arr_drop(v->v.a);
+	var_setn(v, s.p, s.len);
+	if (s.len <= SSO_MAX) return;
+	// the text reads back exactly, so its parse is known already
+	string* str = v->v.s;
+	switch (old.t) {
+		case TYPE_INTEGER:
+			str->i = old.v.i;
+			str->ie = 0;
+			str->n = (double)old.v.i;
+			str->ne = 0;
+			break;
+		case TYPE_NUMBER:
+			str->n = old.v.n;
+			str->ne = 0;
+			break;
+		case TYPE_UINTEGER:
+			str->n = (double)old.v.u;
+			str->ne = 0;
+			break;
+		default:
+			break;
+	}
 }
 
 static var var_froms(const char* s) {
 	nukeif(!s);
 	var res;
-	res.t = TYPE_STRING;
-	res.v.s = checked_malloc(sizeof(string));
-	*res.v.s = string_from(s);
+	size_t len = checked_strlen(s);
+	if (len <= SSO_MAX) var_setn(&res, s, len);
+	else var_sets(&res, string_from(s));
 	return res;
 }
 
@@ -855,38 +2282,40 @@ static void var_toarr(var* v) {
 	if (v->t == TYPE_ARRAY) return;
 	var res;
 	res.t = TYPE_ARRAY;
-	res.v.a = checked_malloc(sizeof(arr));
-	res.v.a->len = 1;
-	res.v.a->cap = 8;
-	res.v.a->p = checked_malloc(sizeof(var)*res.v.a->cap);
-	res.v.a->p[0] = *v;
+	res.v.a = arr_new();
+	arr_append(res.v.a, *v);
 	*v = res;
 }
 
+__attribute__((cold))
+static void f_grow(void) {
+	size_t depth = f ? (size_t)(f - fs) : 0;
+	fcap = fcap ? fcap*2 : 64;
+	fs = checked_realloc(fs, sizeof(frame)*fcap);
+	f = fs + depth;
+}
+
 __attribute__((hot))
 static void f_push(void) {
 	if (f == NULL) {
-		f = checked_malloc(sizeof(frame));
+		f_grow();
 		f->v.t = TYPE_NONE;
 		f->v.v._ = NULL;
 	}
-	frame* res = checked_malloc(sizeof(frame));
-	res->v.t = TYPE_NONE;
-	res->v.v._ = NULL;
-	res->n = f;
-	f = res;
+	if (f + 1 == fs + fcap) f_grow();
+	f++;
+	f->v.t = TYPE_NONE;
+	f->v.v._ = NULL;
 }
 
 static void f_free(void) {
 	var_clear(f_ref());
-	frame* temp = f;
-	f = f->n;
-	checked_free(temp);
+	f--;
 }
 
 static string f_drops(void) {
 	var_stringify(f_ref());
-	string temp = *f->v.v.s;
+	string temp = *var_heaps(f_ref());
 	checked_free(f->v.v.s);
 	f->v.t = TYPE_NONE;
 	f->v.v._ = NULL;
@@ -908,54 +2337,64 @@ static void f_assume(var s) {
 static void f_sweep(void);
 
 static void f_collapse(void) {
-	switch(f->n->v.t) {
+	switch(f[-1].v.t) {
 		case TYPE_NONE:
 			f_sweep();
 			return;
 		default:
 			var_stringify(f_ref());
-			var_stringify(&f->n->v);
-			string_cat(f->n->v.v.s, f->v.v.s);
-			checked_free(f->v.v.s->p);
-			f->v.v.s->p = NULL;
-			checked_free(f->v.v.s);
-			f->v.v.s = NULL;
-			frame* temp = f;
-			f = f->n;
-			checked_free(temp);
+			var_stringify(&f[-1].v);
+			var_cat(&f[-1].v, f_ref());
+			var_clear(f_ref());
+			f--;
 			break;
 	}
 }
 
 static void f_sweep(void) {
-	var_clear(&f->n->v);
-	frame* temp = f->n;
-	f->n = f->n->n;
-	checked_free(temp);
+	var_clear(&f[-1].v);
+	f[-1] = *f;
+	f--;
+}
+
+// v after acc, the way f_collapse puts a call after its caller's text
+static void var_join(var* acc, var v) {
+	if (acc->t == TYPE_NONE) {
+		*acc = v;
+		return;
+	}
+	var_stringify(acc);
+	var_stringify(&v);
+	var_cat(acc, &v);
+	var_clear(&v);
 }
 
 __attribute__((hot))
 static void f_pushc(char c) {
 	var_stringify(f_ref());
-	string_pushc(f->v.v.s, c);
+	var_pushc(f_ref(), c);
+}
+
+static void f_pushn(const char* s, size_t n) {
+	nukeif(!s);
+	var_stringify(f_ref());
+	var_pushn(f_ref(), s, n);
 }
 
 static void f_pushs(const char* s) {
 	nukeif(!s);
 	var_stringify(f_ref());
-	string_pushs(f->v.v.s, s);
+	var_pushs(f_ref(), s);
 }
 
 static void f_terminate(void) {
 	var_stringify(f_ref());
-	string_terminate(f->v.v.s);
+	var_cstr(f_ref());
 }
 
 static void f_replaces(const char* s) {
 	var_clear(f_ref());
-	f->v.t = TYPE_STRING;
-	f->v.v.s = checked_malloc(sizeof(string));
-	*f->v.v.s = string_from(s);
+	var_setn(f_ref(), s, checked_strlen(s));
 }
 
 static void f_replacef(void) {
@@ -1000,20 +2439,15 @@ static void var_clear(var* v) {
 	nukeif(!v);
 	switch (v->t) {
 		case TYPE_STRING:
+		case TYPE_ERROR:
+			if (var_sso(v) || --v->v.s->rc) break;
 			checked_free(v->v.s->p);
 			v->v.s->p = NULL;
 			checked_free(v->v.s);
 			v->v.s = NULL;
 			break;
-		case TYPE_ERROR:
-			checked_free(v->v.e->p);
-			v->v.e->p = NULL;
-			checked_free(v->v.e);
-			v->v.e = NULL;
-			break;
 		case TYPE_ARRAY:
-			arr_clear(v->v.a);
-			checked_free(v->v.a);
+			arr_drop(v->v.a);
 			v->v.a = NULL;
 			break;
 		default:
@@ -1025,58 +2459,77 @@ static void var_clear(var* v) {
 
 static char* f_refs(void) {
 	var_stringify(f_ref());
-	return f->v.v.s->p;
+	return var_cstr(f_ref());
 }
 
 static constr f_refcs(void) {
 	var_stringify(f_ref());
-	return constr_from(*f->v.v.s);
+	return var_cs(f_ref());
 }
 
-static double f_num(void) {
+static double var_num(var* v) {
 	errno = 0;
-	switch(f->v.t) {
+	switch(v->t) {
 		case TYPE_STRING:
-			f_terminate();
-			return s_tod(f_refs());
+			if (var_sso(v)) return s_tod(var_cs(v));
+			string* s = v->v.s;
+			if (s->ne == NO_PARSE) {
+				s->n = s_tod(var_cs(v));
+				s->ne = errno;
+			}
+			errno = s->ne;
+			return s->n;
 		case TYPE_NUMBER:
-			return f->v.v.n;
+			return v->v.n;
 		case TYPE_INTEGER:
-			return (double)f->v.v.i;
+			return (double)v->v.i;
 		case TYPE_UINTEGER:
-			return (double)f->v.v.u;
+			return (double)v->v.u;
 		case TYPE_BOOLEAN:
-			return (double)f->v.v.b;
+			return (double)v->v.b;
 		default:
 			return 0.0;
 	}
 }
 
-static long long int f_int(void) {
+static long long int var_int(var* v) {
 	errno = 0;
-	switch(f->v.t) {
+	switch(v->t) {
 		case TYPE_STRING:
-			f_terminate();
-			return s_toi(f_refs());
+			if (var_sso(v)) return s_toi(var_cs(v));
+			string* s = v->v.s;
+			if (s->ie == NO_PARSE) {
+				s->i = s_toi(var_cs(v));
+				s->ie = errno;
+			}
+			errno = s->ie;
+			return s->i;
 		case TYPE_NUMBER:
-			return (long long int)f->v.v.n;
+			return (long long int)v->v.n;
 		case TYPE_INTEGER:
-			return f->v.v.i;
+			return v->v.i;
 		case TYPE_UINTEGER:
-			return (long long int)f->v.v.u;
+			return (long long int)v->v.u;
 		case TYPE_BOOLEAN:
-			return (long long int)f->v.v.b;
+			return (long long int)v->v.b;
 		default:
 			return 0;
 	}
 }
 
+static double f_num(void) {
+	return var_num(f_ref());
+}
+
+static long long int f_int(void) {
+	return var_int(f_ref());
+}
+
 static size_t f_uint(void) {
 	errno = 0;
 	switch(f->v.t) {
 		case TYPE_STRING:
-			f_terminate();
-			return s_tou(f_refs());
+			return s_tou(var_cs(f_ref()));
 		case TYPE_NUMBER:
 			return (size_t)f->v.v.n;
 		case TYPE_INTEGER:
@@ -1090,23 +2543,228 @@ static size_t f_uint(void) {
 	}
 }
 
-static bool f_bool(void) {
-	switch(f->v.t) {
+static arith arith_n(double n) {
+	arith r = {.t = AR_NUM, .n = n};
+	if (n == floor(n) && fabs(n) <= 0x1p53) {
+		r.t = AR_INT;
+		r.i = (long long int)n;
+	}
+	return r;
+}
+
+static arith var_arith(var* v) {
+	switch (v->t) {
+		case TYPE_INTEGER:
+			return (arith) {.t = AR_INT, .i = v->v.i, .n = (double)v->v.i};
+		case TYPE_UINTEGER:
+			return (arith) {.t = AR_UINT, .u = v->v.u, .n = (double)v->v.u};
+		default:
+			return arith_n(var_num(v));
+	}
+}
+
+static arith f_arith(void) {
+	return var_arith(f_ref());
+}
+
+static arith arith_do(char op, arith a, arith b) {
+	arith r;
+	if (a.t == AR_UINT && b.t == AR_UINT) {
+		r.t = AR_UINT;
+		switch (op) {
+			case '+': if (!__builtin_add_overflow(a.u, b.u, &r.u)) goto done; break;
+			case '-': if (!__builtin_sub_overflow(a.u, b.u, &r.u)) goto done; break;
+			case '*': if (!__builtin_mul_overflow(a.u, b.u, &r.u)) goto done; break;
+			case '/':
+				if (b.u == 0 || a.u % b.u) break;
+				r.u = a.u / b.u;
+				goto done;
+			case '%':
+				if (b.u == 0) break;
+				r.u = a.u % b.u;
+				goto done;
+		}
+	} else if (a.t != AR_NUM && b.t != AR_NUM && (a.t == AR_INT || a.u <= INT64_MAX) && (b.t == AR_INT || b.u <= INT64_MAX)) {
+		r.t = AR_INT;
+		switch (op) {
+			case '+': if (!__builtin_add_overflow(a.i, b.i, &r.i)) goto done; break;
+			case '-': if (!__builtin_sub_overflow(a.i, b.i, &r.i)) goto done; break;
+			case '*': if (!__builtin_mul_overflow(a.i, b.i, &r.i)) goto done; break;
+			case '/':
+				if (b.i == 0 || (b.i == -1 && a.i == INT64_MIN) || a.i % b.i) break;
+				r.i = a.i / b.i;
+				goto done;
+			case '%':
+				if (b.i == 0) break;
+				r.i = b.i == -1 ? 0 : a.i % b.i;
+				goto done;
+		}
+	}
+	r.t = AR_NUM;
+	switch (op) {
+		case '+': r.n = a.n + b.n; break;
+		case '-': r.n = a.n - b.n; break;
+		case '*': r.n = a.n * b.n; break;
+		case '/': r.n = a.n / b.n; break;
+		case '%': r.n = fmod(a.n, b.n); break;
+		default: __builtin_unreachable();
+	}
+	return r;
+done:
+	r.n = r.t == AR_INT ? (double)r.i : (double)r.u;
+	return r;
+}
+
+static var arith_var(arith a) {
+	switch (a.t) {
+		case AR_INT: return (var) {.t = TYPE_INTEGER, .v.i = a.i};
+		case AR_UINT: return (var) {.t = TYPE_UINTEGER, .v.u = a.u};
+		default: return (var) {.t = TYPE_NUMBER, .v.n = a.n};
+	}
+}
+
+static void f_replacea(arith a) {
+	var_clear(f_ref());
+	f->v = arith_var(a);
+}
+
+// a numeric string compares by the integer it spells once that is past what
+// a double holds exactly, else by its double (0 when it is not a number)
+static arith arith_str(double n, int ne, long long int i, int ie) {
+	if (ne == 0 && ie == 0 && fabs(n) >= 0x1p53 && (double)i == n) return (arith) {.t = AR_INT, .i = i, .n = n};
+	return (arith) {.t = AR_NUM, .n = n};
+}
+
+// one side of a comparison: its number, and its text once that is needed
+typedef struct {
+	arith a;
+	constr s;
+	var* v;
+	char buf[32];
+} cmpv;
+
+#define CMP_NAN 2
+
+static void cmpv_of(cmpv* c, var* v) {
+	c->v = v;
+	c->s.p = NULL;
+	switch (v->t) {
 		case TYPE_STRING:
-			f_terminate();
-			char* end = f_refs();
-			double res = strtod(f_refs(), &end);
-			while ((*end == ' ' || *end == '\t') && *end != '\0') end++;
-			if (*end == '\0') return res != 0;
-			return 1;
+		case TYPE_ERROR:
+			c->s = var_cs(v);
+			double n = var_num(v);
+			int ne = errno;
+			long long int i = 0;
+			int ie = EINVAL;
+			if (ne == 0 && fabs(n) >= 0x1p53) {
+				i = var_int(v);
+				ie = errno;
+			}
+			c->a = arith_str(n, ne, i, ie);
+			return;
 		case TYPE_NUMBER:
-			return f->v.v.n != 0;
 		case TYPE_INTEGER:
-			return f->v.v.i != 0;
 		case TYPE_UINTEGER:
-			return f->v.v.u != 0;
 		case TYPE_BOOLEAN:
-			return f->v.v.b;
+			c->a = var_arith(v);
+			return;
+		default:
+			c->s = (constr) {.p = c->buf, .len = 0};
+			c->a = arith_n(0);
+			return;
+	}
+}
+
+// an integer against a double, exactly: by the double's integer part, then
+// by its fraction
+static int cmp_id(long long int i, double d) {
+	if (d != d) return CMP_NAN;
+	if (d >= 0x1p63) return -1;
+	if (d < -0x1p63) return 1;
+	long long int t = (long long int)d;
+	if (i != t) return i < t ? -1 : 1;
+	double r = d - (double)t;
+	return (r < 0) - (r > 0);
+}
+
+static int cmp_ud(unsigned long long int u, double d) {
+	if (d != d) return CMP_NAN;
+	if (d < 0) return 1;
+	if (d >= 0x1p64) return -1;
+	unsigned long long int t = (unsigned long long int)d;
+	if (u != t) return u < t ? -1 : 1;
+	double r = d - (double)t;
+	return (r < 0) - (r > 0);
+}
+
+static int cmp_num(arith x, arith y) {
+	if (x.t == AR_INT && y.t == AR_INT) return (x.i > y.i) - (x.i < y.i);
+	if (x.t != AR_NUM && y.t != AR_NUM) {
+		if (x.t == AR_INT && x.i < 0) return -1;
+		if (y.t == AR_INT && y.i < 0) return 1;
+		return (x.u > y.u) - (x.u < y.u);
+	}
+	if (x.t == AR_NUM && y.t == AR_NUM) {
+		if (x.n != x.n || y.n != y.n) return CMP_NAN;
+		return (x.n > y.n) - (x.n < y.n);
+	}
+	if (x.t == AR_INT) return cmp_id(x.i, y.n);
+	if (x.t == AR_UINT) return cmp_ud(x.u, y.n);
+	int c = y.t == AR_INT ? cmp_id(y.i, x.n) : cmp_ud(y.u, x.n);
+	return c == CMP_NAN ? c : -c;
+}
+
+static int cmpv_str(cmpv* x, cmpv* y) {
+	if (!x->s.p) x->s = num_fmt(x->v, x->buf);
+	if (!y->s.p) y->s = num_fmt(y->v, y->buf);
+	int c = constrcmp(x->s, y->s);
+	return (c > 0) - (c < 0);
+}
+
+static bool cmp_is(int op, int c) {
+	switch (op) {
+		case X_EQ: return c == 0;
+		case X_NE: return c != 0;
+		case X_LT: return c == -1;
+		case X_LE: return c == -1 || c == 0;
+		case X_GT: return c == 1;
+		case X_GE: return c == 0 || c == 1;
+		default: __builtin_unreachable();
+	}
+}
+
+// comparisons in ex hold if either the numbers or the texts do
+static bool cmpv_do(int op, cmpv* x, cmpv* y) {
+	return cmp_is(op, cmp_num(x->a, y->a)) || cmp_is(op, cmpv_str(x, y));
+}
+
+static bool var_cmp(int op, var* x, var* y) {
+	cmpv a, b;
+	cmpv_of(&a, x);
+	cmpv_of(&b, y);
+	return cmpv_do(op, &a, &b);
+}
+
+// for = and !=: how many of the numbers and the texts agree
+static int var_agree(var* x, var* y) {
+	cmpv a, b;
+	cmpv_of(&a, x);
+	cmpv_of(&b, y);
+	return (cmp_num(a.a, b.a) == 0) + (cmpv_str(&a, &b) == 0);
+}
+
+static bool var_bool(var* v) {
+	switch(v->t) {
+		case TYPE_STRING:
+			return s_tob(var_cs(v));
+		case TYPE_NUMBER:
+			return v->v.n != 0;
+		case TYPE_INTEGER:
+			return v->v.i != 0;
+		case TYPE_UINTEGER:
+			return v->v.u != 0;
+		case TYPE_BOOLEAN:
+			return v->v.b;
 		case TYPE_NONE:
 			return 0;
 		default:
@@ -1115,6 +2773,10 @@ static bool f_bool(void) {
 	
 }
 
+static bool f_bool(void) {
+	return var_bool(f_ref());
+}
+
 static void f_replaceb(bool x) {
 	var_clear(f_ref());
 	f->v.t = TYPE_BOOLEAN;
@@ -1128,13 +2790,26 @@ static bool f_eq(const char* s) {
 
 static void* flatmaps_search(flatmaps* x, void* y) {
 	nukeif(!x);
-	void* res = NULL;
-	size_t i = 0;
-	do {
-		i++;
-		res = flatmap_search(&x->p[x->len-i], y);
-	} while (res == NULL && i < x->len);
-	return res;
+	nukeif(!y);
+	constr k = *(constr*)y;
+	symbol* sym = flatmap_search(&x->names, k, key_hash(k));
+	return sym ? symbol_top(sym) : NULL;
+}
+
+// builtins cannot be shadowed, so they are looked for first; core methods
+// can be, by met, so user methods come first
+static token* token_find(constr k) {
+	token* t = core_find(k);
+	if (t) return t;
+	token key = {.k = k};
+	return flatmaps_search(&tokens, (void*)&key);
+}
+
+static meth* meth_find(constr k) {
+	meth key = {.k = k};
+	meth* m = flatmaps_search(&meths, (void*)&key);
+	if (m) return m;
+	return core_meth_find(k);
 }
 
 static bool has_next(void) {
@@ -1145,53 +2820,74 @@ static bool has_next(void) {
 
 static result raw_parse(void);
 static result parse_next(void);
+static result body_next(void);
 static void raw_skip(void);
 static void skip_next(void);
 static void pure_next(void);
 static result parse_token(void);
+static result call_token(token* t);
 static result parse_var(var* obj);
 static result expr_next(void);
 
+// the array and its buffer live in the region, from the caller's mark
 static result parse_args(var* prev, var* new) {
 	nukeif(!new);
+	rmark mark = region_mark();
 	args = new;
 	args->t = TYPE_ARRAY;
-	args->v.a = checked_malloc(sizeof(arr));
-	args->v.a->len = 0;
-	args->v.a->cap = 0;
-	args->v.a->p = NULL;
+	args->v.a = region_alloc(sizeof(arr));
+	arr* a = args->v.a;
+	a->len = 0;
+	a->cap = 0;
+	a->p = NULL;
+	a->rc = 1;
 	while (has_next()) {
 		RES = parse_next();
 		if (RES) {
 			var_clear(args);
+			region_reset(mark);
 			args = prev;
 			return RES;
 		}
-		arr_append(args->v.a, f_drop());
+		if (a->len == a->cap) {
+			size_t cap = a->cap ? a->cap*2 : 4;
+			a->p = region_realloc(a->p, sizeof(elem)*a->cap, sizeof(elem)*cap);
+			a->cap = cap;
+		}
+		a->p[a->len++] = elem_put(f_drop());
 	}
 	ok;
 }
 
+static void args_clear(rmark mark) {
+	var_clear(args);
+	region_reset(mark);
+}
+
 static result parse_token(void) {
 	bool has_args = has_next();
+	bool tail = tail_pos;
+	tail_pos = false;
 	if (f->v.t == TYPE_FUNCTION || f->v.t == TYPE_MACRO || f->v.t == TYPE_EXPRESSION) {
 		var v = f_drop();
 		var* tempa = args;
 		var newa;
+		rmark mark = region_mark();
 		if (has_args) {
 			tryor(parse_args(tempa, &newa), var_clear(&v));	
 		} else args = NULL;
 		if (v.t != TYPE_MACRO) {
-			flatmaps_push(&tokens, 0);
-			flatmaps_push(&libs, 0);
-			flatmaps_push(&meths, 0);
+			flatmaps_push(&tokens);
+			flatmaps_push(&libs);
+			flatmaps_push(&meths);
 		}
 		char* temp = w;
 		w = v.v.f;
-		RES = (v.t == TYPE_EXPRESSION) ? expr_next() : parse_next();
-		if (has_args) {
-			var_clear(args);
-		}
+		token* fn = fn_cur;
+		fn_cur = NULL;
+		RES = (v.t == TYPE_EXPRESSION) ? expr_next() : body_next();
+		fn_cur = fn;
+		if (has_args) args_clear(mark);
 		args = tempa;
 		w = temp;
 		if (v.t != TYPE_MACRO) {
@@ -1215,64 +2911,117 @@ static result parse_token(void) {
 		ok;
 	}
 	token key = {.k = f_refcs()};
-	token* t = flatmaps_search(&tokens, (void*)&key);
+	token* t = token_find(key.k);
 	if (t == NULL) {
-		string name = f_drops();
 		if (!has_next()) {
-			checked_free(name.p);
+			var_clear(f_ref());
 			ok;
 		}
+		symbol* sym = flatmaps_intern(&tokens, key.k);
+		var_clear(f_ref());
 		token* temp = checked_malloc(sizeof(token));
-		temp->k.p = name.p;
-		temp->k.len = name.len;
+		temp->k = sym->k;
 		temp->t = TOKEN_FUNC;
 		temp->p.f = w;
-		flatmap_insert(&tokens.p[tokens.len-1], temp);
+		flatmaps_bind(&tokens, sym, temp);
 		ok;
 	}
+	tail_pos = tail;
+	return call_token(t);
+}
+
+static result token_run(token* t);
+
+static result call_token(token* t) {
+	prof_push(t->k.p, t->k.len);
+	RES = token_run(t);
+	prof_pop();
+	return RES;
+}
+
+static result token_run(token* t) {
+	bool has_args = has_next();
+	bool tail = tail_pos;
+	tail_pos = false;
 	if (t->t == TOKEN_FUNCP) {
-		return t->p.fp();
+		tail_in = tail;
+		RES = t->p.fp();
+		tail_pos = tail;
+		return RES;
 	}
 	if (t->t == TOKEN_FUNC) {
 		var_clear(f_ref());
 		var* tempa = args;
 		var newa;
+		rmark mark = region_mark();
 		if (has_args) {
 			try(parse_args(tempa, &newa));	
 		} else args = NULL;
-		flatmaps_push(&tokens, 0);
-		flatmaps_push(&libs, 0);
-		flatmaps_push(&meths, 0);
+		if (tail && t == fn_cur) {
+			tail_args = has_args ? newa : (var) {.t = TYPE_NONE, .v._ = NULL};
+			tail_swept = false;
+			args = tempa;
+			return RESULT_TAIL;
+		}
+		token* fn = fn_cur;
+		fn_cur = t;
+		var acc = {.t = TYPE_NONE, .v._ = NULL};
+		flatmaps_push(&tokens);
+		flatmaps_push(&libs);
+		flatmaps_push(&meths);
 		char* temp = w;
-		w = t->p.f;
-		RES = parse_next();
-		if (has_args) {
-			var_clear(args);
+		// self calls in tail position come back here and run the body
+		// again in the same scope, on the same C stack
+		for (;;) {
+			w = t->p.f;
+			tail_pos = true;
+			RES = body_next();
+			if (RES != RESULT_TAIL) break;
+			var_join(&acc, f_drop());
+			var na = var_copy(tail_args);
+			var_clear(&tail_args);
+			if (has_args) var_clear(args);
+			region_reset(mark);
+			has_args = na.t != TYPE_NONE;
+			newa = na;
+			args = has_args ? &newa : NULL;
 		}
+		if (has_args) args_clear(mark);
 		args = tempa;
 		w = temp;
+		fn_cur = fn;
+		tail_pos = tail;
 		flatmaps_free(&tokens);
 		flatmaps_free(&libs);
 		flatmaps_free(&meths);
-		if (RES == RESULT_ERROR) return RES;
+		if (RES == RESULT_ERROR) {
+			var_clear(&acc);
+			return RES;
+		}
+		if (acc.t != TYPE_NONE) {
+			var_join(&acc, f_drop());
+			f_assume(acc);
+		}
 		ok;
 	}
 	if (t->t == TOKEN_EXPR) {
 		var_clear(f_ref());
 		var* tempa = args;
 		var newa;
+		rmark mark = region_mark();
 		if (has_args) {
 			try(parse_args(tempa, &newa));	
 		} else args = NULL;
-		flatmaps_push(&tokens, 0);
-		flatmaps_push(&libs, 0);
-		flatmaps_push(&meths, 0);
+		flatmaps_push(&tokens);
+		flatmaps_push(&libs);
+		flatmaps_push(&meths);
 		char* temp = w;
 		w = t->p.e;
+		token* fn = fn_cur;
+		fn_cur = NULL;
 		RES = expr_next();
-		if (has_args) {
-			var_clear(args);
-		}
+		fn_cur = fn;
+		if (has_args) args_clear(mark);
 		args = tempa;
 		w = temp;
 		flatmaps_free(&tokens);
@@ -1285,15 +3034,17 @@ static result parse_token(void) {
 		var_clear(f_ref());
 		var* tempa = args;
 		var newa;
+		rmark mark = region_mark();
 		if (has_args) {
 			try(parse_args(tempa, &newa));	
 		} else args = NULL;
 		char* temp = w;
 		w = t->p.m;
-		RES = parse_next();
-		if (has_args) {
-			var_clear(args);
-		}
+		token* fn = fn_cur;
+		fn_cur = NULL;
+		RES = body_next();
+		fn_cur = fn;
+		if (has_args) args_clear(mark);
 		args = tempa;
 		w = temp;
 		if (RES == RESULT_ERROR) return RES;
@@ -1322,22 +3073,24 @@ static result parse_var(var* obj) {
 		var v = f_drop();
 		var* tempa = args;
 		var newa;
+		rmark mark = region_mark();
 		if (has_args) {
 			tryor(parse_args(tempa, &newa), var_clear(&v));	
 		} else args = NULL;
 		var* temps = self;
 		self = obj;
 		if (v.t != TYPE_MACRO) {
-			flatmaps_push(&tokens, 0);
-			flatmaps_push(&libs, 0);
-			flatmaps_push(&meths, 0);
+			flatmaps_push(&tokens);
+			flatmaps_push(&libs);
+			flatmaps_push(&meths);
 		}
 		char* temp = w;
 		w = v.v.f;
-		RES = (v.t == TYPE_EXPRESSION) ? expr_next() : parse_next();
-		if (has_args) {
-			var_clear(args);
-		}
+		token* fn = fn_cur;
+		fn_cur = NULL;
+		RES = (v.t == TYPE_EXPRESSION) ? expr_next() : body_next();
+		fn_cur = fn;
+		if (has_args) args_clear(mark);
 		args = tempa;
 		self = temps;
 		w = temp;
@@ -1354,8 +3107,27 @@ static result parse_var(var* obj) {
 	if (errno == 0) {
 		if (obj->t == TYPE_ARRAY) {
 			if (i < obj->v.a->len) {
+				if (has_args) var_arrw(obj);
+#ifdef NANBOX
+				// works on the element unboxed, then puts it back only if
+				// the slot still holds it. If the method reassigned or
+				// removed it, what e shares went with it
+				arr* a = obj->v.a;
+				elem old = a->p[i];
+				var e = elem_get(old);
+				var v = e;
+				RES = parse_var(&e);
+				if (obj->t != TYPE_ARRAY || obj->v.a != a || i >= a->len || a->p[i] != old) {
+					if (memcmp(&e, &v, sizeof(var)) != 0) var_clear(&e);
+					return RES;
+				}
+				if (elem_cell(old)) checked_free((void*)(uintptr_t)(old & BOX_PAYLOAD));
+				a->p[i] = elem_put(e);
+				return RES;
+#else
 				try(parse_var(&obj->v.a->p[i]));
 				ok;
+#endif
 			}
 			var_clear(f_ref());
 			ok;	
@@ -1364,65 +3136,155 @@ static result parse_var(var* obj) {
 		ok;
 	}
 	meth key = {.k = f_refcs()};
-	meth* method = flatmaps_search(&meths, (void*)&key);
+	meth* method = meth_find(key.k);
 	if (method == NULL) {
 		var_clear(f_ref());
 		ok;
 	}
-	if (method->t == METHOD_FUNCP)
-		return method->p.meth(obj);
+	if (method->t == METHOD_FUNCP) {
+		prof_push(method->k.p, method->k.len);
+		RES = method->p.meth(obj);
+		prof_pop();
+		return RES;
+	}
 	if (method->t == METHOD_FUNC) {
+		prof_push(method->k.p, method->k.len);
 		var* tempa = args;
 		var newa;
+		rmark mark = region_mark();
 		if (has_args) {
-			try(parse_args(tempa, &newa));
+			tryor(parse_args(tempa, &newa), prof_pop());
 		} else args = NULL;
 		var* temps = self;
 		self = obj;
-		flatmaps_push(&tokens, 0);
-		flatmaps_push(&libs, 0);
+		flatmaps_push(&tokens);
+		flatmaps_push(&libs);
 		char* temp = w;
 		w = method->p.f;
-		RES = parse_next();
-		if (has_args) {
-			var_clear(args);
-		}
+		token* fn = fn_cur;
+		fn_cur = NULL;
+		RES = body_next();
+		fn_cur = fn;
+		if (has_args) args_clear(mark);
 		args = tempa;
 		self = temps;
 		w = temp;
 		flatmaps_free(&tokens);
 		flatmaps_free(&libs);
+		prof_pop();
 		if (RES == RESULT_ERROR) return RES;
 		ok;
 	}
 	__builtin_unreachable();
 }
 
-static result raw_parse(void) {
-	char* start;
+static result call_fail(char* start) {
+	// a tail call keeps what the caller wrote so far, unless a return
+	// already threw it away
+	if (RES == RESULT_TAIL && !tail_swept) f_collapse();
+	else f_sweep();
+	w = start;
+	while (has_next()) skip_next();
+	return RES;
+}
+
+static void call_close(void) {
+	while (has_next()) skip_next();
+	f_collapse();
+	if (*w != '\0') w++;
+}
+
+static result parse_call(void) {
+	char* start = w;
+	w++;
+	f_push();
+	bool tp = tail_pos;
+	tail_pos = false;
+	RES = raw_parse();
+	tail_pos = tp;
+	if (RES) return call_fail(start);
+	RES = parse_token();
+	if (RES) return call_fail(start);
+	call_close();
+	ok;
+}
+
+// runs a call whose head is plain text, with its frame already pushed and w
+// right after the head; skips building the name in a frame to look it up
+static result name_token(constr name, icache* ic) {
+	token* t = NULL;
+	if (strncmp(code_start, name.p, name.len) != 0 || code_start[name.len] != '\0') {
+		if (ic->t == NULL && ic->s == NULL) {
+			ic->t = core_find(name);
+			if (ic->t == NULL) {
+				ic->s = flatmaps_intern(&tokens, name);
+				ic->s->refs++;
+			}
+		}
+		t = ic->t ? ic->t : symbol_top(ic->s);
+	}
+	if (t == NULL) {
+		f_pushn(name.p, name.len);
+		return parse_token();
+	}
+	return call_token(t);
+}
+
+// same as parse_call for a head that is plain text of n bytes
+static result parse_name(size_t n, icache* ic) {
+	char* start = w;
+	constr name = {.p = w + 1, .len = n};
+	w += n + 1;
+	f_push();
+	RES = name_token(name, ic);
+	if (RES) return call_fail(start);
+	call_close();
+	ok;
+}
+
+// first '{', ';', '}', backslash or NUL at or after p. Only whole aligned
+// 16 byte blocks are loaded, so the read past the terminator never leaves
+// the page it is on
+#if defined(__SSE2__)
+static unsigned scan_special16(__m128i v) {
+	__m128i m = _mm_cmpeq_epi8(v, _mm_set1_epi8(open));
+	m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(next)));
+	m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(close)));
+	m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+	m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_setzero_si128()));
+	return (unsigned)_mm_movemask_epi8(m);
+}
+
+__attribute__((no_sanitize_address))
+static char* scan_special(char* p) {
+	uintptr_t off = (uintptr_t)p & 15;
+	const __m128i* v = (const __m128i*)(p - off);
+	unsigned mask = scan_special16(_mm_load_si128(v)) & (0xFFFFu << off);
+	while (mask == 0) mask = scan_special16(_mm_load_si128(++v));
+	return (char*)v + __builtin_ctz(mask);
+}
+#else
+static char* scan_special(char* p) {
+	while (*p != '\0' && *p != open && *p != next && *p != close && *p != '\\') p++;
+	return p;
+}
+#endif
+
+static result raw_walk(void) {
 	while (*w != '\0') {
+		char* end = scan_special(w);
+		if (end != w) {
+			f_pushn(w, end - w);
+			w = end;
+			continue;
+		}
 		if (*w == next || *w == close) ok;
 		if (*w == open) {
-			start = w;	
-			w++;
-			f_push();
-			RES = raw_parse();
-			if (RES) {
-				f_sweep();
-				w = start;
-				while (has_next()) skip_next();
-				return RES;
-			}
-			RES = parse_token();
-			if (RES) {
-				f_sweep();
-				w = start;
-				while (has_next()) skip_next();
-				return RES;
-			}
-			while (has_next()) skip_next();
-			f_collapse();
-			if (*w != '\0') w++;
+			bool tp = tail_pos;
+			tail_pos = false;
+			RES = parse_call();
+			tail_pos = tp;
+			if (RES) return RES;
 			continue;	
 		}
 		if (*w == '\\') {
@@ -1435,6 +3297,110 @@ static result raw_parse(void) {
 	ok;
 }
 
+static void block_op(block* b, op o) {
+	if (o.t == OP_TEXT && o.len == 0) return;
+	if (b->len == b->cap) {
+		b->cap = b->cap ? b->cap*2 : 4;
+		b->ops = checked_realloc(b->ops, sizeof(op)*b->cap);
+	}
+	b->ops[b->len++] = o;
+}
+
+// length of a head block that is nothing but plain text, 0 otherwise
+static size_t block_name(block* b) {
+	if (b->len == 2 && b->ops[0].t == OP_TEXT && b->ops[0].p == b->k && b->end == b->k + b->ops[0].len) return b->ops[0].len;
+	return 0;
+}
+
+static block* block_compile(source* s, char* p) {
+	block* b = cache_find(&s->blocks, p);
+	if (b) return b;
+	b = checked_malloc(sizeof(block));
+	b->k = p;
+	b->len = 0;
+	b->cap = 0;
+	b->ops = NULL;
+	char* run = p;
+	while (*p != '\0' && *p != next && *p != close) {
+		if (*p == '\\') {
+			block_op(b, (op) {.t = OP_TEXT, .p = run, .len = p - run});
+			p++;
+			if (*p == '\0') break;
+			run = p++;
+			continue;
+		}
+		if (*p == open) {
+			block_op(b, (op) {.t = OP_TEXT, .p = run, .len = p - run});
+			block* head = block_compile(s, p + 1);
+			char* q = head->end;
+			while (*q == next) q = block_compile(s, q + 1)->end;
+			if (*q == close) q++;
+			op call = {.t = OP_CALL, .p = p, .len = q - p, .n = block_name(head)};
+			if (call.n) call.t = OP_TOKEN;
+			block_op(b, call);
+			run = p = q;
+			continue;
+		}
+		p++;
+	}
+	block_op(b, (op) {.t = OP_TEXT, .p = run, .len = p - run});
+	// a call with nothing after it gives the block its last word
+	if (b->len && b->ops[b->len-1].t != OP_TEXT) b->ops[b->len-1].tail = true;
+	block_op(b, (op) {.t = OP_END, .p = p});
+	b->end = p;
+	cache_insert(&s->blocks, b);
+	return b;
+}
+
+// threaded dispatch: every handler jumps straight to the next op's
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+static result block_run(block* b) {
+	static void* const dispatch[] = {
+		[OP_TEXT] = &&op_text,
+		[OP_CALL] = &&op_call,
+		[OP_TOKEN] = &&op_token,
+		[OP_END] = &&op_end
+	};
+	op* o = b->ops;
+	bool tp;
+	goto *dispatch[o->t];
+op_text:
+	f_pushn(o->p, o->len);
+	o++;
+	goto *dispatch[o->t];
+op_call:
+	w = o->p;
+	tp = tail_pos;
+	tail_pos = tp && o->tail;
+	RES = parse_call();
+	tail_pos = tp;
+	if (RES) return RES;
+	if (w != o->p + o->len) return raw_walk();
+	o++;
+	goto *dispatch[o->t];
+op_token:
+	w = o->p;
+	tp = tail_pos;
+	tail_pos = tp && o->tail;
+	RES = parse_name(o->n, &o->ic);
+	tail_pos = tp;
+	if (RES) return RES;
+	if (w != o->p + o->len) return raw_walk();
+	o++;
+	goto *dispatch[o->t];
+op_end:
+	w = b->end;
+	ok;
+}
+#pragma GCC diagnostic pop
+
+static result raw_parse(void) {
+	block* b = block_find(w);
+	if (b) return block_run(b);
+	return raw_walk();
+}
+
 static void raw_skip(void) {
 	size_t nest = 1;
 	while (*w != '\0') {
@@ -1455,8 +3421,17 @@ static void raw_skip(void) {
 
 static void skip_next(void) {
 	if (has_next()) {
+		char* to = source_skip(w);
 		w++;
+		if (to == NULL) {
+			raw_skip();
+			return;
+		}
+#ifdef DEBUG
 		raw_skip();
+		assert(w == to);
+#endif
+		w = to;
 	}
 }
 
@@ -1469,9 +3444,25 @@ static result parse_next(void) {
 	ok;
 }
 
+// user code bodies are compiled the first time they run, as long as they
+// live in a buffer that outlives them; anything else is walked as text
+static result body_next(void) {
+	if (*w == next) {
+		source* s = source_of(w);
+		if (s) block_compile(s, w + 1);
+	}
+	return parse_next();
+}
+
 static void raw_pure(void) {
 	size_t nest = 1;
 	while (*w != '\0') {
+		char* end = scan_special(w);
+		if (end != w) {
+			f_pushn(w, end - w);
+			w = end;
+			continue;
+		}
 		if (*w == close) nest--;
 		if (*w == next && nest == 1) nest--;
 		if (*w == open) {
@@ -1496,10 +3487,13 @@ static void pure_next(void) {
 	}
 }
 
+// comparisons go through var_cmp, with the left side moved out of the frame
+// while the right one is walked
 static result raw_expr(int l) {
-	double leftd, rightd;
+	double rightd;
+	arith lefta;
 	long long int lefti, righti;
-	constr left;
+	var left;
 	while (*w != '\0') {
 		switch(*w) {
 		case '"':
@@ -1545,11 +3539,10 @@ static result raw_expr(int l) {
 					ok;
 				}
 				w++;
-				f_terminate();
-				left = constr_from(f_drops());
-				tryor(raw_expr(4), checked_free(left.p));
-				f_replaceb(s_tod(left.p) != f_num() || constrcmp(f_refcs(), left) != 0);
-				checked_free(left.p);
+				left = f_drop();
+				tryor(raw_expr(4), var_clear(&left));
+				f_replaceb(var_cmp(X_NE, &left, f_ref()));
+				var_clear(&left);
 				break;
 			}
 			f_push();
@@ -1565,14 +3558,14 @@ static result raw_expr(int l) {
 			f_collapse();
 			break;
 		case '*':
-			leftd = f_num();
+			lefta = f_arith();
 			w++;
 			if (*w == '*') {
 				w++;
 				var_clear(f_ref());
 				try(raw_expr(0));
 				rightd = f_num();
-				f_replacen(pow(leftd, rightd));
+				f_replacen(pow(lefta.n, rightd));
 				break;
 			}
 			if (l < 1) {
@@ -1581,11 +3574,10 @@ static result raw_expr(int l) {
 			}
 			var_clear(f_ref());
 			try(raw_expr(1));
-			rightd = f_num();
-			f_replacen(leftd * rightd);
+			f_replacea(arith_do('*', lefta, f_arith()));
 			break;
 		case '/':
-			leftd = f_num();
+			lefta = f_arith();
 			w++;
 			if (l < 1) {
 				w--;
@@ -1593,11 +3585,10 @@ static result raw_expr(int l) {
 			}
 			var_clear(f_ref());
 			try(raw_expr(1));
-			rightd = f_num();
-			f_replacen(leftd / rightd);
+			f_replacea(arith_do('/', lefta, f_arith()));
 			break;
 		case '%':
-			leftd = f_num();
+			lefta = f_arith();
 			w++;
 			if (l < 1) {
 				w--;
@@ -1605,11 +3596,10 @@ static result raw_expr(int l) {
 			}
 			var_clear(f_ref());
 			try(raw_expr(1));
-			rightd = f_num();
-			f_replacen(fmod(leftd, rightd));
+			f_replacea(arith_do('%', lefta, f_arith()));
 			break;
 		case '+':
-			leftd = f_num();
+			lefta = f_arith();
 			w++;
 			if (l < 2) {
 				w--;
@@ -1617,11 +3607,10 @@ static result raw_expr(int l) {
 			}
 			var_clear(f_ref());
 			try(raw_expr(2));
-			rightd = f_num();
-			f_replacen(leftd + rightd);
+			f_replacea(arith_do('+', lefta, f_arith()));
 			break;
 		case '-':
-			leftd = f_num();
+			lefta = f_arith();
 			w++;
 			if (l < 2) {
 				w--;
@@ -1629,8 +3618,7 @@ static result raw_expr(int l) {
 			}
 			var_clear(f_ref());
 			try(raw_expr(2));
-			rightd = f_num();
-			f_replacen(leftd - rightd);
+			f_replacea(arith_do('-', lefta, f_arith()));
 			break;
 		case '=':
 			w++;
@@ -1644,11 +3632,10 @@ static result raw_expr(int l) {
 				w--;
 				ok;
 			}
-			f_terminate();
-			left = constr_from(f_drops());
-			tryor(raw_expr(4), checked_free(left.p));
-			f_replaceb(f_num() == s_tod(left.p) || constrcmp(f_refcs(), left) == 0);
-			checked_free(left.p);
+			left = f_drop();
+			tryor(raw_expr(4), var_clear(&left));
+			f_replaceb(var_cmp(X_EQ, &left, f_ref()));
+			var_clear(&left);
 			break;
 		case '<':
 			w++;
@@ -1672,22 +3659,20 @@ static result raw_expr(int l) {
 					ok;
 				}
 				w++;
-				f_terminate();
-				left = constr_from(f_drops());
-				tryor(raw_expr(4), checked_free(left.p));
-				f_replaceb(s_tod(left.p) <= f_num() || constrcmp(left, f_refcs()) <= 0);
-				checked_free(left.p);
+				left = f_drop();
+				tryor(raw_expr(4), var_clear(&left));
+				f_replaceb(var_cmp(X_LE, &left, f_ref()));
+				var_clear(&left);
 				break;
 			}
 			if (l < 4) {
 				w--;
 				ok;
 			}
-			f_terminate();
-			left = constr_from(f_drops());
-			tryor(raw_expr(4), checked_free(left.p));
-			f_replaceb(s_tod(left.p) < f_num() || constrcmp(left, f_refcs()) < 0);
-			checked_free(left.p);
+			left = f_drop();
+			tryor(raw_expr(4), var_clear(&left));
+			f_replaceb(var_cmp(X_LT, &left, f_ref()));
+			var_clear(&left);
 			break;
 		case '>':
 			w++;
@@ -1711,22 +3696,20 @@ static result raw_expr(int l) {
 					ok;
 				}
 				w++;
-				f_terminate();
-				left = constr_from(f_drops());
-				tryor(raw_expr(4), checked_free(left.p));
-				f_replaceb(s_tod(left.p) >= f_num() || constrcmp(left, f_refcs()) >= 0);
-				checked_free(left.p);
+				left = f_drop();
+				tryor(raw_expr(4), var_clear(&left));
+				f_replaceb(var_cmp(X_GE, &left, f_ref()));
+				var_clear(&left);
 				break;
 			}
 			if (l < 4) {
 				w--;
 				ok;
 			}
-			f_terminate();
-			left = constr_from(f_drops());
-			tryor(raw_expr(4), checked_free(left.p));
-			f_replaceb(s_tod(left.p) > f_num() || constrcmp(left, f_refcs()) > 0);
-			checked_free(left.p);
+			left = f_drop();
+			tryor(raw_expr(4), var_clear(&left));
+			f_replaceb(var_cmp(X_GT, &left, f_ref()));
+			var_clear(&left);
 			break;
 		case '&':
 			lefti = f_int();
@@ -1814,10 +3797,535 @@ static result raw_expr(int l) {
 	ok;
 }
 
+// EXPRESSIONS
+//
+// an expression is compiled once by following raw_expr over its text and
+// emitting postfix ops; what each level of raw_expr holds in its frame is
+// tracked as XS_NONE, XS_LIT (digits and quoted text seen so far) or XS_VAL.
+// Anything raw_expr would concatenate as text is left to raw_expr.
+
+enum {
+	XS_NONE,
+	XS_LIT,
+	XS_VAL
+};
+
+static void xprog_op(xprog* x, xop o) {
+	if (x->len == x->cap) {
+		x->cap = x->cap ? x->cap*2 : 8;
+		x->ops = checked_realloc(x->ops, sizeof(xop)*x->cap);
+	}
+	x->ops[x->len++] = o;
+}
+
+static bool xprog_lit(xprog* x, int* st, char c) {
+	if (*st == XS_VAL) return false;
+	if (*st == XS_NONE) {
+		xprog_op(x, (xop) {.t = X_LIT, .l = {.p = NULL, .len = 0}});
+		*st = XS_LIT;
+	}
+	xlit* l = &x->ops[x->len-1].l;
+	l->p = checked_realloc(l->p, l->len + 2);
+	l->p[l->len++] = c;
+	l->p[l->len] = '\0';
+	return true;
+}
+
+static void xprog_slot(xprog* x, int* st) {
+	if (*st == XS_NONE) xprog_op(x, (xop) {.t = X_NONE});
+	*st = XS_VAL;
+}
+
+// a call is kept only if nothing inside it can be read differently by a
+// nested raw_expr than by raw_skip
+static bool xprog_call(source* s, xprog* x, char** at) {
+	char* p = *at;
+	block* head = block_compile(s, p + 1);
+	char* q = head->end;
+	while (*q == next) q = block_compile(s, q + 1)->end;
+	if (*q != close) return false;
+	q++;
+	for (char* c = p; c < q; c++)
+		if (*c == '"' || *c == expropen || *c == exprclose) return false;
+	xprog_op(x, (xop) {.t = X_CALL, .c = {.p = p, .len = q - p, .n = block_name(head)}});
+	*at = q;
+	return true;
+}
+
+static bool xprog_level(source* s, xprog* x, char** at, int l, int* st);
+
+static bool xprog_bin(source* s, xprog* x, char** at, int* st, int l, int t) {
+	int sub = XS_NONE;
+	xprog_slot(x, st);
+	if (!xprog_level(s, x, at, l, &sub)) return false;
+	xprog_slot(x, &sub);
+	xprog_op(x, (xop) {.t = t});
+	return true;
+}
+
+static bool xprog_unary(source* s, xprog* x, char** at, int* st, int t) {
+	int sub = XS_NONE;
+	if (*st != XS_NONE) return false;
+	if (!xprog_level(s, x, at, 0, &sub)) return false;
+	xprog_slot(x, &sub);
+	xprog_op(x, (xop) {.t = t});
+	*st = XS_VAL;
+	return true;
+}
+
+static bool xprog_level(source* s, xprog* x, char** at, int l, int* st) {
+	char* q = *at;
+	int sub;
+	while (*q != '\0') {
+		switch(*q) {
+		case '"':
+			for (q++; *q != '"'; q++) {
+				if (*q == '\\') q++;
+				if (*q == '\0') return false;
+				if (!xprog_lit(x, st, *q)) return false;
+			}
+			q++;
+			break;
+		case '0':
+		case '1':
+		case '2':
+		case '3':
+		case '4':
+		case '5':
+		case '6':
+		case '7':
+		case '8':
+		case '9':
+		case '.':
+			if (!xprog_lit(x, st, *q)) return false;
+			q++;
+			break;
+		case expropen:
+			if (*st != XS_NONE) return false;
+			q++;
+			sub = XS_NONE;
+			if (!xprog_level(s, x, &q, 9, &sub)) return false;
+			*st = sub;
+			break;
+		case '!':
+			q++;
+			if (*q == '=') {
+				if (l < 4) {
+					q--;
+					goto out;
+				}
+				q++;
+				if (!xprog_bin(s, x, &q, st, 4, X_NE)) return false;
+				break;
+			}
+			if (!xprog_unary(s, x, &q, st, X_NOT)) return false;
+			break;
+		case '~':
+			q++;
+			if (!xprog_unary(s, x, &q, st, X_INV)) return false;
+			break;
+		case '*':
+			q++;
+			if (*q == '*') {
+				q++;
+				if (!xprog_bin(s, x, &q, st, 0, X_POW)) return false;
+				break;
+			}
+			if (l < 1) {
+				q--;
+				goto out;
+			}
+			if (!xprog_bin(s, x, &q, st, 1, X_MUL)) return false;
+			break;
+		case '/':
+			q++;
+			if (l < 1) {
+				q--;
+				goto out;
+			}
+			if (!xprog_bin(s, x, &q, st, 1, X_DIV)) return false;
+			break;
+		case '%':
+			q++;
+			if (l < 1) {
+				q--;
+				goto out;
+			}
+			if (!xprog_bin(s, x, &q, st, 1, X_MOD)) return false;
+			break;
+		case '+':
+			q++;
+			if (l < 2) {
+				q--;
+				goto out;
+			}
+			if (!xprog_bin(s, x, &q, st, 2, X_ADD)) return false;
+			break;
+		case '-':
+			q++;
+			if (l < 2) {
+				q--;
+				goto out;
+			}
+			if (!xprog_bin(s, x, &q, st, 2, X_SUB)) return false;
+			break;
+		case '=':
+			q++;
+			if (*q == '<') {
+				goto lessoreq;
+			}
+			if (*q == '>') {
+				goto moreoreq;
+			}
+			if (l < 4) {
+				q--;
+				goto out;
+			}
+			if (!xprog_bin(s, x, &q, st, 4, X_EQ)) return false;
+			break;
+		case '<':
+			q++;
+			if (*q == '<') {
+				if (l < 3) {
+					q--;
+					goto out;
+				}
+				q++;
+				if (!xprog_bin(s, x, &q, st, 8, X_SHL)) return false;
+				break;
+			}
+			if (*q == '=') {
+			lessoreq:
+				if (l < 4) {
+					q--;
+					goto out;
+				}
+				q++;
+				if (!xprog_bin(s, x, &q, st, 4, X_LE)) return false;
+				break;
+			}
+			if (l < 4) {
+				q--;
+				goto out;
+			}
+			if (!xprog_bin(s, x, &q, st, 4, X_LT)) return false;
+			break;
+		case '>':
+			q++;
+			if (*q == '>') {
+				if (l < 3) {
+					q--;
+					goto out;
+				}
+				q++;
+				if (!xprog_bin(s, x, &q, st, 8, X_SHR)) return false;
+				break;
+			}
+			if (*q == '=') {
+			moreoreq:
+				if (l < 4) {
+					q--;
+					goto out;
+				}
+				q++;
+				if (!xprog_bin(s, x, &q, st, 4, X_GE)) return false;
+				break;
+			}
+			if (l < 4) {
+				q--;
+				goto out;
+			}
+			if (!xprog_bin(s, x, &q, st, 4, X_GT)) return false;
+			break;
+		case '&':
+			q++;
+			if (*q == '&') {
+				if (l < 8) {
+					q--;
+					goto out;
+				}
+				q++;
+				if (!xprog_bin(s, x, &q, st, 8, X_LAND)) return false;
+				break;
+			}
+			if (l < 5) {
+				q--;
+				goto out;
+			}
+			if (!xprog_bin(s, x, &q, st, 5, X_AND)) return false;
+			break;
+		case '^':
+			q++;
+			if (l < 6) {
+				q--;
+				goto out;
+			}
+			if (!xprog_bin(s, x, &q, st, 6, X_XOR)) return false;
+			break;
+		case '|':
+			q++;
+			if (*q == '|') {
+				if (l < 9) {
+					q--;
+					goto out;
+				}
+				q++;
+				if (!xprog_bin(s, x, &q, st, 9, X_LOR)) return false;
+				break;
+			}
+			if (l < 7) {
+				q--;
+				goto out;
+			}
+			if (!xprog_bin(s, x, &q, st, 7, X_OR)) return false;
+			break;
+		case exprclose:
+			q++;
+			goto out;
+		case next:
+		case close:
+			goto out;
+		case open:
+			if (*st != XS_NONE) return false;
+			if (!xprog_call(s, x, &q)) return false;
+			*st = XS_VAL;
+			break;
+		case '\\':
+			q++;
+			if (*q == '\0') goto out;
+		default:
+			q++;
+			break;
+		}
+	}
+out:
+	*at = q;
+	return true;
+}
+
+static xprog* xprog_compile(source* s, char* p) {
+	xprog* x = cache_find(&s->exprs, p);
+	if (x) return x;
+	x = checked_malloc(sizeof(xprog));
+	x->k = p;
+	x->len = 0;
+	x->cap = 0;
+	x->depth = 0;
+	x->ops = NULL;
+	int st = XS_NONE;
+	char* q = p;
+	x->fallback = !xprog_level(s, x, &q, 9, &st);
+	x->end = q;
+	if (x->fallback) {
+		for (size_t i = 0; i < x->len; i++)
+			if (x->ops[i].t == X_LIT) checked_free(x->ops[i].l.p);
+		x->len = 0;
+	}
+	size_t sp = 0;
+	for (size_t i = 0; i < x->len; i++) {
+		xop* o = &x->ops[i];
+		switch (o->t) {
+			case X_LIT:
+				constr lit = {o->l.p, o->l.len};
+				o->l.i = s_toi(lit);
+				int ie = errno;
+				o->l.n = s_tod(lit);
+				o->l.a = arith_str(o->l.n, errno, o->l.i, ie);
+				o->l.b = s_tob(lit);
+			case X_NONE:
+			case X_CALL:
+				sp++;
+				if (sp > x->depth) x->depth = sp;
+			case X_NOT:
+			case X_INV:
+				break;
+			default:
+				sp--;
+				break;
+		}
+	}
+	cache_insert(&s->exprs, x);
+	return x;
+}
+
+// a value on the evaluation stack: either a literal of the program or a var
+typedef struct {
+	var v;
+	xlit* l;
+} xslot;
+
+static double xslot_num(xslot* s) {
+	if (s->l) return s->l->n;
+	return var_num(&s->v);
+}
+
+static long long int xslot_int(xslot* s) {
+	if (s->l) return s->l->i;
+	return var_int(&s->v);
+}
+
+static arith xslot_arith(xslot* s) {
+	if (s->l) return arith_n(s->l->n);
+	return var_arith(&s->v);
+}
+
+static bool xslot_bool(xslot* s) {
+	if (s->l) return s->l->b;
+	return var_bool(&s->v);
+}
+
+static void xslot_cmpv(xslot* s, cmpv* c) {
+	if (!s->l) {
+		cmpv_of(c, &s->v);
+		return;
+	}
+	c->s = (constr) {.p = s->l->p ? s->l->p : c->buf, .len = s->l->len};
+	c->a = s->l->a;
+}
+
+static bool xslot_cmp(int op, xslot* a, xslot* b) {
+	cmpv x, y;
+	xslot_cmpv(a, &x);
+	xslot_cmpv(b, &y);
+	return cmpv_do(op, &x, &y);
+}
+
+static void xslot_clear(xslot* s) {
+	if (s->l == NULL) var_clear(&s->v);
+	s->l = NULL;
+}
+
+static result xprog_call_run(xop* o) {
+	f_push();
+	if (o->c.n) {
+		w = o->c.p + 1 + o->c.n;
+		RES = name_token((constr) {.p = o->c.p + 1, .len = o->c.n}, &o->c.ic);
+	} else {
+		w = o->c.p + 1;
+		RES = raw_parse();
+		if (RES == RESULT_OK) RES = parse_token();
+	}
+	if (RES) {
+		f_sweep();
+		return RES;
+	}
+	while (has_next()) skip_next();
+	ok;
+}
+
+static result xprog_run(xprog* x) {
+	xslot small[16];
+	xslot* st = x->depth > 16 ? checked_malloc(sizeof(xslot)*x->depth) : small;
+	size_t sp = 0;
+	xslot *a, *b;
+	var v;
+	long long int li, ri;
+	for (xop* o = x->ops; o < x->ops + x->len; o++) {
+		switch (o->t) {
+			case X_LIT:
+				st[sp++] = (xslot) {.l = &o->l};
+				continue;
+			case X_NONE:
+				st[sp++] = (xslot) {.v = {.t = TYPE_NONE, .v._ = NULL}, .l = NULL};
+				continue;
+			case X_CALL:
+				RES = xprog_call_run(o);
+				if (RES) {
+					while (sp) xslot_clear(&st[--sp]);
+					if (st != small) checked_free(st);
+					return RES;
+				}
+				st[sp++] = (xslot) {.v = f_drop(), .l = NULL};
+				f_free();
+				continue;
+			case X_NOT:
+				b = &st[sp-1];
+				v = (var) {.t = TYPE_BOOLEAN, .v.b = !xslot_bool(b)};
+				xslot_clear(b);
+				b->v = v;
+				continue;
+			case X_INV:
+				b = &st[sp-1];
+				v = (var) {.t = TYPE_INTEGER, .v.i = ~xslot_int(b)};
+				xslot_clear(b);
+				b->v = v;
+				continue;
+			default:
+				break;
+		}
+		a = &st[sp-2];
+		b = &st[sp-1];
+		switch (o->t) {
+			case X_POW:
+				v = (var) {.t = TYPE_NUMBER, .v.n = pow(xslot_num(a), xslot_num(b))};
+				break;
+			case X_MUL:
+				v = arith_var(arith_do('*', xslot_arith(a), xslot_arith(b)));
+				break;
+			case X_DIV:
+				v = arith_var(arith_do('/', xslot_arith(a), xslot_arith(b)));
+				break;
+			case X_MOD:
+				v = arith_var(arith_do('%', xslot_arith(a), xslot_arith(b)));
+				break;
+			case X_ADD:
+				v = arith_var(arith_do('+', xslot_arith(a), xslot_arith(b)));
+				break;
+			case X_SUB:
+				v = arith_var(arith_do('-', xslot_arith(a), xslot_arith(b)));
+				break;
+			case X_SHL:
+				v = (var) {.t = TYPE_INTEGER, .v.i = xslot_int(a) << xslot_int(b)};
+				break;
+			case X_SHR:
+				v = (var) {.t = TYPE_INTEGER, .v.i = xslot_int(a) >> xslot_int(b)};
+				break;
+			case X_AND:
+				v = (var) {.t = TYPE_INTEGER, .v.i = xslot_int(a) & xslot_int(b)};
+				break;
+			case X_XOR:
+				v = (var) {.t = TYPE_INTEGER, .v.i = xslot_int(a) ^ xslot_int(b)};
+				break;
+			case X_OR:
+				v = (var) {.t = TYPE_INTEGER, .v.i = xslot_int(a) | xslot_int(b)};
+				break;
+			case X_LAND:
+				li = xslot_int(a);
+				ri = xslot_int(b);
+				v = (var) {.t = TYPE_BOOLEAN, .v.b = li && ri};
+				break;
+			case X_LOR:
+				li = xslot_int(a);
+				ri = xslot_int(b);
+				v = (var) {.t = TYPE_BOOLEAN, .v.b = li || ri};
+				break;
+			default:
+				v = (var) {.t = TYPE_BOOLEAN, .v.b = xslot_cmp(o->t, a, b)};
+				break;
+		}
+		xslot_clear(a);
+		xslot_clear(b);
+		a->v = v;
+		sp--;
+	}
+	w = x->end;
+	if (sp) {
+		if (st->l) f_replaces(st->l->p);
+		else f_assume(st->v);
+	}
+	if (st != small) checked_free(st);
+	ok;
+}
+
 static result expr_next(void) {
 	var_clear(f_ref());
 	if (has_next()) {
 		w++;
+		source* s = source_of(w);
+		if (s) {
+			xprog* x = xprog_compile(s, w);
+			if (!x->fallback) return xprog_run(x);
+		}
 		try(raw_expr(9));
 	}
 	ok;
@@ -1826,27 +4334,26 @@ static result expr_next(void) {
 static result lib_push(char* filename) {
 	nukeif(!filename);
 	char* temp = w;
-	struct lib* library = checked_malloc(sizeof(struct lib));
-	library->k.p = filename;
-	library->k.len = checked_strlen(filename);
-	struct lib* search = flatmaps_search(&libs, library);
-	if (search) {
-		checked_free(filename);
-		ok;
-	}
-	FILE* file = fopen(filename, "r");
+	symbol* sym = flatmaps_intern(&libs, (constr) {.p = filename, .len = checked_strlen(filename)});
+	checked_free(filename);
+	if (symbol_top(sym)) ok;
+	FILE* file = fopen(sym->k.p, "r");
 	if (file == NULL) {
-		checked_free(filename);
+		flatmaps_reclaim(&libs, sym);
 		ok;
 	}
+	struct lib* library = checked_malloc(sizeof(struct lib));
+	library->k = sym->k;
 	fseek(file, 0L, SEEK_END);
 	size_t size = ftell(file) + 1;
 	rewind(file);
 	library->v = checked_malloc(size);
 	fread(library->v, 1, size, file);
+	library->v[size-1] = '\0';
 	if (library->v[size-2] == '\n') library->v[size-2] = '\0';
 	fclose(file);
-	flatmap_insert(&libs.p[libs.len-1], library);
+	flatmaps_bind(&libs, sym, library);
+	source_push(library->v);
 	w = library->v;
 	char* code_temp = code_start;
 	code_start = library->v;
@@ -1865,23 +4372,27 @@ result walker_w(void) {
 	string code = f_drops();
 	var* tempa = args;
 	var newa;
+	rmark mark = region_mark();
 	if (has_args) {
 		try(parse_args(tempa, &newa));	
 	} else args = NULL;
-	flatmaps_push(&tokens, 0);
-	flatmaps_push(&libs, 0);
-	flatmaps_push(&meths, 0);
+	flatmaps_push(&tokens);
+	flatmaps_push(&libs);
+	flatmaps_push(&meths);
 	char* temp = w;
 	char* code_temp = code_start;
 	code_start = code.p;
 	w = code.p;
+	source_push(code.p);
+	token* fn = fn_cur;
+	fn_cur = NULL;
 	RES = raw_parse();
-	if (has_args) {
-		var_clear(args);
-	}
+	fn_cur = fn;
+	if (has_args) args_clear(mark);
 	args = tempa;
 	w = temp;
 	code_start = code_temp;
+	source_drop(code.p);
 	checked_free(code.p);
 	flatmaps_free(&tokens);
 	flatmaps_free(&libs);
@@ -1925,7 +4436,11 @@ result walker_rename(void) {
 }
 
 result walker_return(void) {
-	try(parse_next());
+	// what comes back is the fun's value, wherever the return sits
+	tail_pos = true;
+	RES = parse_next();
+	if (RES == RESULT_TAIL) tail_swept = true;
+	if (RES) return RES;
 	return RESULT_RETURN;
 }
 
@@ -1939,7 +4454,7 @@ result walker_include(void) {
 result walker_token(void) {
 	try(parse_next());
 	token key = {.k = f_refcs()};
-	token* token = flatmaps_search(&tokens, (void*)&key);
+	token* token = token_find(key.k);
 	if (token == NULL) {
 		f_replaces("undefined");
 		ok;
@@ -1987,7 +4502,7 @@ result walker_throw(void) {
 
 result walker_try(void) {
 	RES = parse_next();
-	if (RES == RESULT_RETURN) return RES;
+	if (RES == RESULT_RETURN || RES == RESULT_TAIL) return RES;
 	if (f->v.t == TYPE_ERROR) {
 		f->v.t = TYPE_STRING;
 	}
@@ -2093,7 +4608,7 @@ again:
 result walker_length(void) {	
 	try(parse_next());
 	var_stringify(f_ref());
-	f_replaceu(f->v.v.s->len);
+	f_replaceu(var_cs(f_ref()).len);
 	ok;
 }
 
@@ -2103,12 +4618,10 @@ result walker_newline(void) {
 }
 
 result walker_if(void) {
+	bool tail = tail_in;
 	try(expr_next());
-	if (f_bool()) {
-		try(parse_next());
-		ok;
-	}
-	skip_next();
+	if (!f_bool()) skip_next();
+	tail_pos = tail;
 	try(parse_next());
 	ok;
 }
@@ -2162,38 +4675,36 @@ result walker_scanc(void) {
 }
 
 result walker_eq(void) {
-	constr temp;
+	var temp;
 	try(parse_next());
-	f_terminate();
-	temp = constr_from(f_drops());
+	temp = f_drop();
 	while (has_next()) {
-		tryor(parse_next(), checked_free(temp.p));
-		if (f_num() != s_tod(temp.p) || constrcmp(f_refcs(), temp) != 0) {
+		tryor(parse_next(), var_clear(&temp));
+		if (var_agree(&temp, f_ref()) != 2) {
 			f_replaceb(false);
-			checked_free(temp.p);
+			var_clear(&temp);
 			ok;
 		}
 	}
 	f_replaceb(true);
-	checked_free(temp.p);
+	var_clear(&temp);
 	ok;
 }
 
 result walker_noneq(void) {
-	constr temp;
+	var temp;
 	try(parse_next());
-	f_terminate();
-	temp = constr_from(f_drops());
+	temp = f_drop();
 	while (has_next()) {
-		tryor(parse_next(), checked_free(temp.p));
-		if (f_num() == s_tod(temp.p) || constrcmp(f_refcs(), temp) == 0) {
+		tryor(parse_next(), var_clear(&temp));
+		if (var_agree(&temp, f_ref()) != 0) {
 			f_replaceb(false);
-			checked_free(temp.p);
+			var_clear(&temp);
 			ok;
 		}
 	}
 	f_replaceb(true);
-	checked_free(temp.p);
+	var_clear(&temp);
 	ok;
 }
 
@@ -2210,51 +4721,48 @@ result walker_not(void) {
 }
 
 result walker_add(void) {
-	double res = 0;
+	arith res = {.t = AR_INT, .i = 0, .n = 0.0};
 	while (has_next()) {
 		try(parse_next());
-		res += f_num();
+		res = arith_do('+', res, f_arith());
 	}
-	f_replacen(res);
+	f_replacea(res);
 	ok;
 }
 
 result walker_sub(void) {
-	double res = 0, temp;
+	arith res;
 	try(parse_next());
-	res = f_num();
+	res = f_arith();
 	while (has_next()) {
 		try(parse_next());
-		temp = f_num();
-		res -= temp;
+		res = arith_do('-', res, f_arith());
 	}
-	f_replacen(res);
+	f_replacea(res);
 	ok;
 }
 
 result walker_mul(void) {
-	double res = 0, temp;
+	arith res;
 	try(parse_next());
-	res = f_num();
+	res = f_arith();
 	while (has_next()) {
 		try(parse_next());
-		temp = f_num();
-		res *= temp;
+		res = arith_do('*', res, f_arith());
 	}
-	f_replacen(res);
+	f_replacea(res);
 	ok;
 }
 
 result walker_div(void) {
-	double res = 0, temp;
+	arith res;
 	try(parse_next());
-	res = f_num();
+	res = f_arith();
 	while (has_next()) {
 		try(parse_next());
-		temp = f_num();
-		res /= temp;
+		res = arith_do('/', res, f_arith());
 	}
-	f_replacen(res);
+	f_replacea(res);
 	ok;
 }
 
@@ -2277,24 +4785,24 @@ result walker_uint(void) {
 }
 
 result walker_let(void) {
-	string name;
 	var value;
 	try(parse_next());
-	name = f_drops();
-	tryor(parse_next(), checked_free(name.p));
+	symbol* sym = flatmaps_intern(&tokens, f_refcs());
+	var_clear(f_ref());
+	sym->refs++;
+	tryor(parse_next(), flatmaps_release(&tokens, sym));
 	value = f_drop();
-	token key = {.k = constr_from(name)};
-	token* t = flatmaps_search(&tokens, (void*)&key);
-	if (t && t->t == TOKEN_FUNCP) {
-		checked_free(name.p);
+	if (core_find(sym->k)) {
 		var_clear(&value);
+		flatmaps_release(&tokens, sym);
 		ok;
 	}
 	token* temp = checked_malloc(sizeof(token));
-	temp->k = constr_from(name);
+	temp->k = sym->k;
 	temp->t = TOKEN_VAR;
 	temp->p.v = value;
-	flatmap_insert(&tokens.p[tokens.len-1], temp);
+	flatmaps_bind(&tokens, sym, temp);
+	flatmaps_release(&tokens, sym);
 	ok;
 }
 
@@ -2317,10 +4825,7 @@ result walker_open_bin(void) {
 result walker_arr(void) {
 	var res;
 	res.t = TYPE_ARRAY;
-	res.v.a = checked_malloc(sizeof(arr));
-	res.v.a->len = 0;
-	res.v.a->cap = 0;
-	res.v.a->p = NULL;
+	res.v.a = arr_new();
 	while (has_next()) {
 		tryor(parse_next(), var_clear(&res));
 		arr_append(res.v.a, f_drop());
@@ -2330,94 +4835,68 @@ result walker_arr(void) {
 }
 
 result walker_fun(void) {	
-	string name;
 	try(parse_next());
-	name = f_drops();
-	if (!has_next()) {
-		checked_free(name.p);
-		ok;
-	}
-	token key = {.k = constr_from(name)};
-	token* t = flatmaps_search(&tokens, (void*)&key);
-	if (t && t->t == TOKEN_FUNCP) {
-		checked_free(name.p);
+	if (!has_next() || core_find(f_refcs())) {
+		var_clear(f_ref());
 		ok;
 	}
+	symbol* sym = flatmaps_intern(&tokens, f_refcs());
+	var_clear(f_ref());
 	token* temp = checked_malloc(sizeof(token));
-	temp->k.p = name.p;
-	temp->k.len = name.len;
+	temp->k = sym->k;
 	temp->t = TOKEN_FUNC;
 	temp->p.f = w;
-	flatmap_insert(&tokens.p[tokens.len-1], temp);
+	flatmaps_bind(&tokens, sym, temp);
 	ok;
 }
 
 result walker_def(void) {
-	string name;
 	try(parse_next());
-	f_terminate();
-	s_tou(f_refs());
-	name = f_drops();
-	if (!has_next()) {
-		checked_free(name.p);
-		ok;
-	}
-	token key = {.k = constr_from(name)};
-	token* t = flatmaps_search(&tokens, (void*)&key);
-	if (t && t->t == TOKEN_FUNCP) {
-		checked_free(name.p);
+	if (!has_next() || core_find(f_refcs())) {
+		var_clear(f_ref());
 		ok;
 	}
+	symbol* sym = flatmaps_intern(&tokens, f_refcs());
+	var_clear(f_ref());
 	token* temp = checked_malloc(sizeof(token));
-	temp->k.p = name.p;
-	temp->k.len = name.len;
+	temp->k = sym->k;
 	temp->t = TOKEN_EXPR;
 	temp->p.e = w;
-	flatmap_insert(&tokens.p[tokens.len-1], temp);
+	flatmaps_bind(&tokens, sym, temp);
 	ok;
 }
 
 result walker_mac(void) {
-	string name;
 	try(parse_next());
-	name = f_drops();
-	if (!has_next()) {
-		checked_free(name.p);
-		ok;
-	}
-	token key = {.k = constr_from(name)};
-	token* t = flatmaps_search(&tokens, (void*)&key);
-	if (t && t->t == TOKEN_FUNCP) {
-		checked_free(name.p);
+	if (!has_next() || core_find(f_refcs())) {
+		var_clear(f_ref());
 		ok;
 	}
+	symbol* sym = flatmaps_intern(&tokens, f_refcs());
+	var_clear(f_ref());
 	token* temp = checked_malloc(sizeof(token));
-	temp->k.p = name.p;
-	temp->k.len = name.len;
+	temp->k = sym->k;
 	temp->t = TOKEN_MACRO;
 	temp->p.m = w;
-	flatmap_insert(&tokens.p[tokens.len-1], temp);
+	flatmaps_bind(&tokens, sym, temp);
 	ok;
 }
 
 result walker_meth(void) {
-	meth* key = checked_malloc(sizeof(meth));
 	try(parse_next());
-	key->k = constr_from(f_drops());
 	if (!has_next()) {
-		checked_free(key->k.p);
-		checked_free(key);
-		ok;
-	}
-	meth* method = flatmaps_search(&meths, (void*)key);
-	if (method && method->t == METHOD_FUNC) {
-		checked_free(key->k.p);
-		checked_free(key);
+		var_clear(f_ref());
 		ok;
 	}
+	symbol* sym = flatmaps_intern(&meths, f_refcs());
+	var_clear(f_ref());
+	meth* method = symbol_top(sym);
+	if (method && method->t == METHOD_FUNC) ok;
+	meth* key = checked_malloc(sizeof(meth));
+	key->k = sym->k;
 	key->t = METHOD_FUNC;
 	key->p.f = w;
-	flatmap_insert(&meths.p[meths.len-1], key);
+	flatmaps_bind(&meths, sym, key);
 	ok;
 }
 
@@ -2465,10 +4944,10 @@ result walker_letter(void) {
 	}
 	try(parse_next());
 	var_stringify(f_ref());
-	if (temp < f->v.v.s->len) {
-		string res = f_drops();
-		f_pushc(res.p[temp]);
-		checked_free(res.p);
+	if (temp < var_cs(f_ref()).len) {
+		char c = var_cs(f_ref()).p[temp];
+		var_clear(f_ref());
+		f_pushc(c);
 		ok;
 	}
 	var_clear(f_ref());
@@ -2519,40 +4998,41 @@ result walker_m(void) {
 	ok;
 }
 
-__attribute__((cold))
-static inline void place_core(void) {
+#define CORE(n, f) {.k = {.p = n, .len = sizeof(n) - 1}, .p.fp = f, .t = TOKEN_FUNCP}
+
+token core_pool[] = {
 	// misc
-	core_funcp_place("timer", walker_timer);
-	core_funcp_place("reset timer", walker_reset_timer);
-	core_funcp_place("timestamp", walker_timestamp);
-	core_funcp_place("rand", walker_rand);
-	core_funcp_place("copy", walker_copy);
-	core_funcp_place("length", walker_length);
+	CORE("timer", walker_timer),
+	CORE("reset timer", walker_reset_timer),
+	CORE("timestamp", walker_timestamp),
+	CORE("rand", walker_rand),
+	CORE("copy", walker_copy),
+	CORE("length", walker_length),
 
 	// control
-	core_funcp_place("if", walker_if);
+	CORE("if", walker_if),
 	// switch
-	core_funcp_place("repeat", walker_repeat);
+	CORE("repeat", walker_repeat),
 	// for
-	core_funcp_place("while", walker_while);
-	core_funcp_place("do-while", walker_do_while);
+	CORE("while", walker_while),
+	CORE("do-while", walker_do_while),
 
 	// io
-	core_funcp_place("print", walker_print);
-	core_funcp_place("println", walker_println);
-	core_funcp_place("scan", walker_scan);
-	core_funcp_place("scanln", walker_scanln);
-	core_funcp_place("scanc", walker_scanc);
+	CORE("print", walker_print),
+	CORE("println", walker_println),
+	CORE("scan", walker_scan),
+	CORE("scanln", walker_scanln),
+	CORE("scanc", walker_scanc),
 	
 	// string
-	core_funcp_place("newline", walker_newline);
-	core_funcp_place("letter", walker_letter);
+	CORE("newline", walker_newline),
+	CORE("letter", walker_letter),
 	// substring
 
 	// logic
-	core_funcp_place("=", walker_eq);
-	core_funcp_place("eq", walker_eq);
-	core_funcp_place("!=", walker_noneq);
+	CORE("=", walker_eq),
+	CORE("eq", walker_eq),
+	CORE("!=", walker_noneq),
 	// >
 	// >= =>
 	// <
@@ -2564,15 +5044,15 @@ static inline void place_core(void) {
 	// ^ xor
 	// <<
 	// >>
-	core_funcp_place("not", walker_not);
-	core_funcp_place("!", walker_not);
+	CORE("not", walker_not),
+	CORE("!", walker_not),
 	// hex
 
 	// math
-	core_funcp_place("+", walker_add);
-	core_funcp_place("-", walker_sub);
-	core_funcp_place("*", walker_mul);
-	core_funcp_place("/", walker_div);
+	CORE("+", walker_add),
+	CORE("-", walker_sub),
+	CORE("*", walker_mul),
+	CORE("/", walker_div),
 	// mod
 	// sin
 	// cos
@@ -2595,31 +5075,31 @@ static inline void place_core(void) {
 	// trunc
 	
 	// type
-	core_funcp_place("type", walker_type);
-	core_funcp_place("bool", walker_bool);
-	core_funcp_place("num", walker_num);
-	core_funcp_place("f64", walker_num);
-	core_funcp_place("int", walker_int);
-	core_funcp_place("i64", walker_int);
-	core_funcp_place("uint", walker_uint);
-	core_funcp_place("u64", walker_uint);
-	core_funcp_place("string", walker_string);
-	core_funcp_place("error", walker_error);
+	CORE("type", walker_type),
+	CORE("bool", walker_bool),
+	CORE("num", walker_num),
+	CORE("f64", walker_num),
+	CORE("int", walker_int),
+	CORE("i64", walker_int),
+	CORE("uint", walker_uint),
+	CORE("u64", walker_uint),
+	CORE("string", walker_string),
+	CORE("error", walker_error),
 
 	// meta
-	core_funcp_place("token", walker_token);
-	core_funcp_place("let", walker_let);
-	core_funcp_place("arr", walker_arr);
-	core_funcp_place("fun", walker_fun);
-	core_funcp_place("f", walker_f);
-	core_funcp_place("def", walker_def);
-	core_funcp_place("x", walker_x);
-	core_funcp_place("mac", walker_mac);
-	core_funcp_place("m", walker_m);
-	core_funcp_place("met", walker_meth);
-	core_funcp_place("quine", walker_quine);
-	core_funcp_place("rename", walker_rename);
-	core_funcp_place("w", walker_w);
+	CORE("token", walker_token),
+	CORE("let", walker_let),
+	CORE("arr", walker_arr),
+	CORE("fun", walker_fun),
+	CORE("f", walker_f),
+	CORE("def", walker_def),
+	CORE("x", walker_x),
+	CORE("mac", walker_mac),
+	CORE("m", walker_m),
+	CORE("met", walker_meth),
+	CORE("quine", walker_quine),
+	CORE("rename", walker_rename),
+	CORE("w", walker_w),
 	// new file x (fopen x w+)
 	// open file x (fopen x r+)
 	// new binary x (fopen x wb+)
@@ -2636,23 +5116,60 @@ static inline void place_core(void) {
 	// x last str
 	// x next str
 	// x to i
-	core_funcp_place("#", walker_comment);
-	core_funcp_place("pure", walker_pure);
-	core_funcp_place("ex", walker_expr);
-	core_funcp_place("return", walker_return);
-	core_funcp_place("open", walker_open);
-	core_funcp_place("next", walker_next);
-	core_funcp_place("close", walker_close);
-	core_funcp_place("include", walker_include);
-	core_funcp_place("throw", walker_throw);
-	core_funcp_place("try", walker_try);
-	core_funcp_place("self", walker_self);
-	core_funcp_place("args", walker_args);
-	core_funcp_place("$", walker_literal_method);
+	CORE("#", walker_comment),
+	CORE("pure", walker_pure),
+	CORE("ex", walker_expr),
+	CORE("return", walker_return),
+	CORE("open", walker_open),
+	CORE("next", walker_next),
+	CORE("close", walker_close),
+	CORE("include", walker_include),
+	CORE("throw", walker_throw),
+	CORE("try", walker_try),
+	CORE("self", walker_self),
+	CORE("args", walker_args),
+	CORE("$", walker_literal_method)
+};
 
-#ifdef DEBUG
-	printf("%lu functions placed\n", core_i);
-#endif	
+// builtins are found through a perfect hash: CORE_SEED was searched for
+// offline so every name in core_pool lands in a slot of core_slots of its
+// own, which holds its index + 1. A new builtin needs a new seed and table;
+// DEBUG builds check them at startup
+
+#define CORE_SEED 1192ull
+#define CORE_SLOTS 256
+
+static size_t core_hash(constr k, uint64_t seed) {
+	uint64_t h = seed ^ k.len;
+	for (size_t i = 0; i < k.len; i++) h = (h ^ (unsigned char)k.p[i]) * 0x100000001B3ull;
+	return h ^ (h >> 32);
+}
+
+static const unsigned char core_slots[256] = {
+	0, 0, 0, 0, 0, 0, 0, 27, 0, 0, 0, 0, 45, 7, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 22, 0, 0, 10, 0, 0, 29, 56,
+	0, 16, 0, 43, 0, 61, 0, 0, 0, 14, 0, 0, 0, 0, 47, 4,
+	0, 0, 0, 0, 0, 39, 0, 9, 0, 0, 49, 0, 57, 0, 0, 0,
+	0, 0, 0, 51, 0, 0, 0, 0, 0, 44, 0, 0, 24, 0, 0, 0,
+	0, 0, 0, 31, 0, 0, 0, 13, 0, 8, 0, 32, 0, 54, 0, 0,
+	0, 0, 0, 0, 20, 0, 0, 0, 0, 15, 0, 0, 0, 0, 0, 40,
+	0, 0, 0, 0, 0, 0, 3, 0, 0, 0, 0, 28, 18, 0, 50, 0,
+	0, 0, 1, 0, 58, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 35,
+	0, 0, 30, 0, 0, 0, 0, 62, 0, 25, 0, 0, 0, 0, 0, 36,
+	0, 0, 0, 2, 19, 0, 0, 0, 0, 0, 0, 59, 0, 0, 0, 55,
+	0, 0, 26, 0, 0, 0, 0, 0, 0, 0, 0, 48, 0, 41, 33, 52,
+	0, 0, 0, 0, 46, 0, 0, 5, 0, 0, 0, 38, 0, 0, 53, 0,
+	37, 0, 0, 0, 60, 0, 0, 0, 0, 0, 0, 21, 0, 17, 0, 0,
+	12, 0, 0, 0, 0, 0, 23, 34, 6, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 11, 0, 0, 0, 0, 0, 42, 0, 0
+};
+
+static token* core_find(constr k) {
+	unsigned char i = core_slots[core_hash(k, CORE_SEED) & (CORE_SLOTS - 1)];
+	if (i == 0) return NULL;
+	token* t = &core_pool[i-1];
+	if (t->k.len != k.len || memcmp(t->k.p, k.p, k.len) != 0) return NULL;
+	return t;
 }
 
 result meth_assign(var* v) {
@@ -2694,7 +5211,7 @@ result meth_append(var* v) {
 	var_toarr(v);
 	while (has_next()) {
 		try(parse_next());
-		arr_append(v->v.a, f_drop());
+		arr_append(var_arrw(v), f_drop());
 	}
 	ok;
 }
@@ -2709,7 +5226,7 @@ result meth_insert(var* v) {
 	}
 	var_toarr(v);
 	try(parse_next());
-	arr_insert(v->v.a, n, f_drop());
+	arr_insert(var_arrw(v), n, f_drop());
 	ok;
 }
 
@@ -2719,20 +5236,22 @@ result meth_call(var* v) {
 		var_clear(f_ref());
 		var* tempa = args;
 		var newa;
+		rmark mark = region_mark();
 		if (has_args) {
 			try(parse_args(tempa, &newa));	
 		} else args = NULL;
 		if (v->t != TYPE_MACRO) {
-			flatmaps_push(&tokens, 0);
-			flatmaps_push(&libs, 0);
-			flatmaps_push(&meths, 0);
+			flatmaps_push(&tokens);
+			flatmaps_push(&libs);
+			flatmaps_push(&meths);
 		}
 		char* temp = w;
 		w = v->v.f;
-		RES = (v->t == TYPE_EXPRESSION) ? expr_next() : parse_next();
-		if (has_args) {
-			var_clear(args);
-		}
+		token* fn = fn_cur;
+		fn_cur = NULL;
+		RES = (v->t == TYPE_EXPRESSION) ? expr_next() : body_next();
+		fn_cur = fn;
+		if (has_args) args_clear(mark);
 		args = tempa;
 		w = temp;
 		if (v->t != TYPE_MACRO) {
@@ -2751,10 +5270,7 @@ result meth_clear(var* v) {
 	var_clear(f_ref());
 	var_clear(v);
 	v->t = TYPE_ARRAY;
-	v->v.a = checked_malloc(sizeof(arr));
-	v->v.a->len = 0;
-	v->v.a->cap = 0;
-	v->v.a->p = NULL;
+	v->v.a = arr_new();
 	ok;
 }
 
@@ -2769,7 +5285,7 @@ result meth_remove(var* v) {
 		var_clear(f_ref());
 		ok;
 	}
-	arr_remove(v->v.a, i);
+	arr_remove(var_arrw(v), i);
 	var_clear(f_ref());
 	ok;
 }
@@ -2785,7 +5301,7 @@ result meth_pop(var* v) {
 		var_clear(f_ref());
 		ok;
 	}
-	f_assume(arr_pop(v->v.a, i));
+	f_assume(arr_pop(var_arrw(v), i));
 	ok;
 }
 
@@ -2798,9 +5314,9 @@ result meth_indexof(var* v) {
 	constr comp = f_refcs();
 	var temp;
 	for (size_t i = 0; i < v->v.a->len; i++) {
-		temp = var_copy(v->v.a->p[i]);
+		temp = var_copy(elem_get(v->v.a->p[i]));
 		var_stringify(&temp);
-		if (constrcmp(constr_from(*temp.v.s), comp) == 0) {
+		if (constrcmp(var_cs(&temp), comp) == 0) {
 			f_replacei(i);
 			var_clear(&temp);
 			ok;
@@ -2819,10 +5335,8 @@ result meth_inc(var* v) {
 			v->v.n = 1.0;
 			ok;
 		case TYPE_STRING:
-			string_terminate(v->v.s);
-			double num = s_tod(v->v.s->p);
-			checked_free(v->v.s->p);
-			checked_free(v->v.s);
+			double num = s_tod(var_cs(v));
+			var_clear(v);
 			v->t = TYPE_NUMBER;
 			v->v.n = num + 1.0;
 			ok;
@@ -2851,10 +5365,8 @@ result meth_dec(var* v) {
 			v->v.n = -1.0;
 			ok;
 		case TYPE_STRING:
-			string_terminate(v->v.s);
-			double num = s_tod(v->v.s->p);
-			checked_free(v->v.s->p);
-			checked_free(v->v.s);
+			double num = s_tod(var_cs(v));
+			var_clear(v);
 			v->t = TYPE_NUMBER;
 			v->v.n = num - 1.0;
 			ok;
@@ -2876,37 +5388,61 @@ result meth_dec(var* v) {
 	
 }
 
-__attribute__((cold))
-static inline void place_core_meth(void) {
-	meth_funcp_place("=", meth_assign);
+#define CORE_METH(n, f) {.k = {.p = n, .len = sizeof(n) - 1}, .p.meth = f, .t = METHOD_FUNCP}
+
+meth core_meth_pool[] = {
+	CORE_METH("=", meth_assign),
 	// +=
-	meth_funcp_place("++", meth_inc);	
+	CORE_METH("++", meth_inc),	
 	// -=
-	meth_funcp_place("--", meth_dec);
+	CORE_METH("--", meth_dec),
 	// *=
 	// /=
 	// %=
 	// >>=
 	// <<=
-	meth_funcp_place("call", meth_call);
-	meth_funcp_place("clear", meth_clear);
-	meth_funcp_place("append", meth_append);
-	meth_funcp_place("insert", meth_insert);
-	meth_funcp_place("pop", meth_pop);
-	meth_funcp_place("remove", meth_remove);
-	meth_funcp_place("indexof", meth_indexof);
-	meth_funcp_place("length", meth_length);
+	CORE_METH("call", meth_call),
+	CORE_METH("clear", meth_clear),
+	CORE_METH("append", meth_append),
+	CORE_METH("insert", meth_insert),
+	CORE_METH("pop", meth_pop),
+	CORE_METH("remove", meth_remove),
+	CORE_METH("indexof", meth_indexof),
+	CORE_METH("length", meth_length),
 	// extend
 	// range
 	// to string
 	// replace
 	// replace all
-	meth_funcp_place("type", meth_type);
+	CORE_METH("type", meth_type)
+};
+
+#define CORE_METH_SEED 11ull
+#define CORE_METH_SLOTS 32
+
+static const unsigned char core_meth_slots[32] = {
+	0, 0, 0, 9, 0, 0, 0, 0, 0, 0, 10, 0, 0, 8, 11, 0,
+	0, 0, 0, 3, 12, 1, 6, 2, 0, 4, 7, 5, 0, 0, 0, 0
+};
+
+static meth* core_meth_find(constr k) {
+	unsigned char i = core_meth_slots[core_hash(k, CORE_METH_SEED) & (CORE_METH_SLOTS - 1)];
+	if (i == 0) return NULL;
+	meth* m = &core_meth_pool[i-1];
+	if (m->k.len != k.len || memcmp(m->k.p, k.p, k.len) != 0) return NULL;
+	return m;
+}
 
 #ifdef DEBUG
-	printf("%lu methods placed\n", core_meth_i);
-#endif
+static void core_check(void) {
+	size_t n = sizeof(core_pool)/sizeof(token);
+	for (size_t i = 0; i < n; i++) assert(core_find(core_pool[i].k) == &core_pool[i]);
+	printf("%lu functions placed\n", n);
+	n = sizeof(core_meth_pool)/sizeof(meth);
+	for (size_t i = 0; i < n; i++) assert(core_meth_find(core_meth_pool[i].k) == &core_meth_pool[i]);
+	printf("%lu methods placed\n", n);
 }
+#endif
 
 // MAIN
 
@@ -2932,9 +5468,9 @@ int main(int argc, char* argv[], char* envp[]) {
 		return 0;
 	}
 	f_push();
-	flatmaps_push(&libs, 8);
-	flatmaps_push(&meths, 64);
-	flatmaps_push(&tokens, 64);
+	flatmaps_push(&libs);
+	flatmaps_push(&meths);
+	flatmaps_push(&tokens);
 	string code;
 	code.p = NULL;
 	var newa;
@@ -2955,6 +5491,7 @@ int main(int argc, char* argv[], char* envp[]) {
 		code.cap = size;
 		code.p = checked_malloc(size);
 		fread(code.p, 1, size, file);
+		code.p[size-1] = '\0';
 		if (code.p[size-2] == '\n') code.p[size-2] = '\0';
 		w = code.p;
 		code_start = code.p;
@@ -2976,22 +5513,22 @@ int main(int argc, char* argv[], char* envp[]) {
 	if (argc-3 > 0) {
 		args = &newa;
 		args->t = TYPE_ARRAY;
-		args->v.a = checked_malloc(sizeof(arr));
-		args->v.a->len = 0;
-		args->v.a->cap = 0;
-		args->v.a->p = NULL;
+		args->v.a = arr_new();
 		for (int i = 0; i < argc-3; i++) {
 			arr_append(args->v.a, var_froms(argv[i+3]));
 		}
 	}
-	place_core();
-	place_core_meth();
+#ifdef DEBUG
+	core_check();
+#endif
+	source_push(w);
 	raw_parse();
+	source_drop(code_start);
 	
 	if (!is_file) {
 		var_stringify(f_ref());
 		f_terminate();
-		printf("%s\n", f->v.v.s->p);
+		printf("%s\n", f_refs());
 	} else {
 		checked_free(code.p);
 	}